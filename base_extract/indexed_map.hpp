@@ -60,6 +60,21 @@ struct indexed_map
 
     indexed_map(const index_functor_type & idx) : indexer(idx) { }
 
+    // The index points into the store, so a copy needs its own.
+    indexed_map(const indexed_map & other)
+        : store(other.store), indexer(other.indexer)
+    {
+        rebuild_index();
+    }
+
+    indexed_map & operator=(const indexed_map & other)
+    {
+        store = other.store;
+        indexer = other.indexer;
+        rebuild_index();
+        return *this;
+    }
+
     class index_collision : public std::exception
     {
         const char * what(void) const throw()
@@ -151,6 +166,12 @@ struct indexed_map
         typename vector<value_type>::iterator iter;
         size_t start = 0, stop = 0, i;
 
+        if (store.empty())
+        {
+            index.clear();
+            return;
+        }
+
         iter = store.end();
         --iter;
         index.resize(indexer(iter->first) + 1);
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <vector>
+
+#include "archive_reader.hpp"
+#include "compressed_block.hpp"
+
+namespace archive2 {
+
+archive_message_reader::archive_message_reader(std::istream & the_is)
+    : is(the_is), at_end(false)
+{
+    is.exceptions(std::istream::eofbit | std::istream::badbit |
+            std::istream::failbit);
+    try
+        { is >> vhr; }
+    catch (volume_header_record::bad_magic & e)
+    {
+        std::cerr
+            << "warning: No volume header record, attempting to read anyway."
+            << std::endl;
+    }
+}
+
+//
+// Reassemble the message whose first segment is the oldest one not yet
+// used. Its other segments may be in blocks not read yet, so reading more
+// blocks and trying again is only given up on at the end of the archive.
+//
+bool
+archive_message_reader::next(rda_message & msg)
+{
+    typedef std::list<rda_message_segment>::iterator rms_list_iter;
+
+    for (;;)
+    {
+        if (!segments.empty())
+        {
+            std::vector<rms_list_iter> consumed_segment_iters;
+            try
+            {
+                consumed_segment_iters =
+                    msg.reassemble(segments.begin(), segments.end());
+            }
+            catch (reassembly_error & e)
+            {
+                if (at_end)
+                    throw;
+            }
+
+            if (!consumed_segment_iters.empty())
+            {
+                std::vector<rms_list_iter>::const_iterator consumed_segment;
+                for (consumed_segment = consumed_segment_iters.begin();
+                        consumed_segment != consumed_segment_iters.end();
+                        ++consumed_segment)
+                    segments.erase(*consumed_segment);
+                return true;
+            }
+        }
+        else if (at_end)
+            return false;
+
+        at_end = !read_block();
+    }
+}
+
+//
+// Read the next compressed block and queue its segments, returning false if
+// there are no more.
+//
+bool
+archive_message_reader::read_block(void)
+{
+    compressed_block cb;
+    try
+        { is >> cb; }
+    catch (std::istream::failure & e)
+        { return false; }
+
+    segments.splice(segments.end(), cb.segments);
+    return true;
+}
+
+} // namespace archive2
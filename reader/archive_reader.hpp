@@ -4,41 +4,51 @@
 #include <iostream>
 #include <list>
 
-#include "archive_primitive.hpp"
-#include "compressed_block.hpp"
+#include "volume_header_record.hpp"
+#include "rda_message_segment.hpp"
 #include "rda_message.hpp"
 
 namespace archive2 {
 
-template <typename OutputIterator>
-void
-read_archive_messages(std::istream & is, OutputIterator oi)
+//
+// Reads the messages of an archive one at a time, decompressing only as many
+// blocks as it takes to reassemble the next one. The stream is read no
+// further than that, so messages can be acted on while the rest of the
+// archive is still arriving, say on a pipe from the radar.
+//
+class archive_message_reader
 {
-    std::list<rda_message_segment> all_segments;
-    {
-        archive_primitive ap;
-        is >> ap;
-        ap.collect_segments(all_segments);
-    }
+public:
+    // Reads the volume header, if there is one.
+    explicit archive_message_reader(std::istream & the_is);
 
-    while (!all_segments.empty())
-    {
-        rda_message msg;
-        typedef std::list<rda_message_segment>::iterator rms_list_iter;
-        std::vector<rms_list_iter> consumed_segment_iters;
-        std::vector<rms_list_iter>::const_iterator consumed_segment;
+    // Reads the next message into msg, returning false at the end of the
+    // archive. Throws reassembly_error if the archive ends part way through
+    // a message.
+    bool next(rda_message & msg);
+
+    const volume_header_record & header(void) const { return vhr; }
 
-        consumed_segment_iters =
-            msg.reassemble(all_segments.begin(), all_segments.end());
+private:
+    bool read_block(void);
 
-        for (consumed_segment = consumed_segment_iters.begin();
-                consumed_segment != consumed_segment_iters.end();
-                ++consumed_segment)
-            all_segments.erase(*consumed_segment);
+    std::istream &                 is;
+    volume_header_record           vhr;
+    std::list<rda_message_segment> segments;
+    bool                           at_end;
+};
 
+template <typename OutputIterator>
+void
+read_archive_messages(std::istream & is, OutputIterator oi)
+{
+    archive_message_reader reader(is);
+    rda_message msg;
+    while (reader.next(msg))
+    {
         *oi = msg;
         ++oi;
-    } 
+    }
 }
 
 } // namespace archive2
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <exception>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "batch_render.hpp"
+#include "work_stealing_pool.hpp"
+#include "site_cache.hpp"
+#include "single_site_tile.hpp"
+#include "coverage.hpp"
+#include "bounds_test.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+/*
+ * One line of a batch: <basefile> <tx> <ty> <zoom> <outfile>, the same
+ * arguments gen-one takes.
+ */
+struct batch_line
+{
+    batch_line() : parsed(false) { }
+
+    bool parsed;
+    std::string base_path;
+    int t_x, t_y, t_z;
+    std::string filename;
+};
+
+typedef std::map< std::string, boost::shared_ptr<const loaded_site> >
+    batch_sites_t;
+typedef work_stealing_pool<size_t> batch_pool_t;
+
+bool
+parse_batch_line(const std::string & text, batch_line & line)
+{
+    std::istringstream is(text);
+    std::string trailing;
+    is >> line.base_path >> line.t_x >> line.t_y >> line.t_z >> line.filename;
+    if (!is || (is >> trailing))
+        return false;
+    return line.t_z >= 0 && line.t_z < 31
+        && line.t_x >= 0 && line.t_x < (1 << line.t_z)
+        && line.t_y >= 0 && line.t_y < (1 << line.t_z);
+}
+
+/*
+ * Renders one line of the batch, then writes out the statuses of every line
+ * that is now finished and not preceded by an unfinished one, so the output
+ * comes out in the order of the input however the lines get scheduled.
+ */
+struct render_task
+{
+    render_task(const std::vector<batch_line> & the_lines,
+            const batch_sites_t & the_sites, const tile_format the_format,
+            std::vector<const char *> & the_statuses, size_t & the_next_out,
+            std::ostream & the_out, boost::mutex & the_out_mutex)
+        : lines(the_lines), sites(the_sites), format(the_format),
+            statuses(the_statuses), next_out(the_next_out), out(the_out),
+            out_mutex(the_out_mutex) { }
+
+    void operator()(const size_t & i, batch_pool_t::worker & w) const
+    {
+        const char * status = render(lines[i]);
+
+        boost::lock_guard<boost::mutex> lock(out_mutex);
+        statuses[i] = status;
+        while (next_out != statuses.size() && statuses[next_out] != 0)
+            out << statuses[next_out++] << '\n';
+        out.flush();
+    }
+
+    const char * render(const batch_line & line) const
+    {
+        if (!line.parsed)
+            return "400";
+
+        const boost::shared_ptr<const loaded_site> & site =
+            sites.find(line.base_path)->second;
+        if (!site)
+            return "500";
+
+        if (!test_tile_intersection(line.t_x, line.t_y, line.t_z,
+                    to_rad(site->cut.latitude), to_rad(site->cut.longitude),
+                    300000.0))
+            return "404";
+
+        try
+        {
+            if (site->coverage.classify(line.t_x, line.t_y, line.t_z)
+                    == COVERAGE_EMPTY)
+                write_empty_tile(line.filename.c_str(), format);
+            else
+                write_tile(site->pyramid, line.t_x, line.t_y, line.t_z,
+                        line.filename.c_str(), format);
+        }
+        catch (std::exception & e)
+        {
+            std::cerr << line.filename << ": " << e.what() << std::endl;
+            return "500";
+        }
+        return "200";
+    }
+
+    const std::vector<batch_line> & lines;
+    const batch_sites_t & sites;
+    const tile_format format;
+    std::vector<const char *> & statuses;
+    size_t & next_out;
+    std::ostream & out;
+    boost::mutex & out_mutex;
+};
+
+/*
+ * Renders every tile listed in the input, one per line as
+ * <basefile> <tx> <ty> <zoom> <outfile>, and writes a status for each line
+ * in the order given: 200 or 404 as gen-one prints, 400 for a line that
+ * can't be parsed, or 500 if the base file can't be read or the tile can't
+ * be written. Blank lines are skipped and get no status.
+ *
+ * Each base file is loaded, and its pyramid built, only once however many
+ * tiles are asked for from it. The base files are loaded in parallel, and
+ * then the tiles are rendered in parallel, one tile per thread. A thread
+ * count of zero uses one thread per hardware thread.
+ */
+void
+render_batch(std::istream & in, std::ostream & out, const size_t thread_count,
+        const tile_format format)
+{
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    std::vector<batch_line> lines;
+    std::vector<std::string> paths;
+    batch_sites_t sites;
+    std::string text;
+    while (std::getline(in, text))
+    {
+        if (text.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        lines.push_back(batch_line());
+        batch_line & line = lines.back();
+        line.parsed = parse_batch_line(text, line);
+        if (line.parsed
+                && sites.insert(std::make_pair(line.base_path,
+                        boost::shared_ptr<const loaded_site>())).second)
+            paths.push_back(line.base_path);
+    }
+
+    loaded_sites_t loaded;
+    load_sites(paths, loaded, n);
+    for (size_t i = 0;
+            i != paths.size();
+            ++i)
+        sites[paths[i]] = loaded[i];
+
+    std::vector<const char *> statuses(lines.size(), 0);
+    size_t next_out = 0;
+    boost::mutex out_mutex;
+    {
+        // Each worker takes the last task pushed onto its deque first, so
+        // push the lines backwards to have them rendered roughly in order and
+        // keep the statuses flowing out.
+        batch_pool_t pool(n);
+        for (size_t i = lines.size();
+                i != 0;
+                --i)
+            pool.push(i - 1);
+        pool.run(render_task(lines, sites, format, statuses, next_out, out,
+                    out_mutex));
+    }
+}
+
+} // namespace tile_generator
@@ -0,0 +1,17 @@
+#ifndef RSME_INCLUDED_BATCH_RENDER_HPP
+#define RSME_INCLUDED_BATCH_RENDER_HPP
+
+#include <cstddef>
+#include <iosfwd>
+
+#include "single_site_tile.hpp"
+
+namespace tile_generator {
+
+void render_batch(std::istream & in, std::ostream & out,
+        const size_t thread_count,
+        const tile_format format = TILE_COLORIZED);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_BATCH_RENDER_HPP
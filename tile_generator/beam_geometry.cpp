@@ -0,0 +1,113 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "beam_geometry.hpp"
+#include "geo_math.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+/*
+ * Height of the beam center above the ground at the given central angle
+ * from the site, in meters, on the same flat-beam model as the slant range.
+ */
+double
+exact_beam_height(const double central_angle, const double elevation)
+{
+    return MEAN_EARTH_RADIUS
+        * (std::cos(elevation) / std::cos(elevation + central_angle) - 1.0);
+}
+
+beam_geometry::beam_geometry(void)
+    : elevation_0_deg(0.0), step(BEAM_GEOMETRY_STEP_METERS / MEAN_EARTH_RADIUS)
+{ }
+
+/*
+ * Tabulate the beam of a cut out to the end of its longest radial. The
+ * ground distance to a gate is never more than its slant range, so that
+ * bounds the central angle.
+ */
+beam_geometry::beam_geometry(const simple_cut & cut)
+    : elevation_0_deg(0.0), step(BEAM_GEOMETRY_STEP_METERS / MEAN_EARTH_RADIUS)
+{
+    using std::sin;
+    using std::cos;
+
+    if (cut.radials.empty())
+        return;
+
+    elevation_0_deg = cut.radials.begin()->second.elevation;
+    const double elevation_0 = to_rad(static_cast<double>(elevation_0_deg));
+
+    float max_range = 0.0;
+    simple_cut::radials_type::const_iterator iter;
+    for (iter = cut.radials.begin();
+            iter != cut.radials.end();
+            ++iter)
+        max_range = std::max(max_range, iter->second.start_range_meters
+                + iter->second.range_res_meters * iter->second.gates.size());
+
+    const size_t count =
+        static_cast<size_t>(max_range / BEAM_GEOMETRY_STEP_METERS) + 2;
+    table.resize(count);
+    for (size_t i = 0;
+            i != count;
+            ++i)
+    {
+        const double phi = i * step;
+        entry & e = table[i];
+        e.range_numerator = MEAN_EARTH_RADIUS * sin(phi);
+        e.cos_sum = cos(elevation_0 + phi);
+        e.sin_sum = sin(elevation_0 + phi);
+        e.height = exact_beam_height(phi, elevation_0);
+    }
+}
+
+/*
+ * Interpolate the table at a central angle. Past its end the position is
+ * left for slant_range() to work out exactly.
+ */
+beam_position
+beam_geometry::locate(const double central_angle) const
+{
+    beam_position p;
+    p.central_angle = central_angle;
+    p.tabulated = false;
+
+    const double position = central_angle / step;
+    if (position >= table.size() - 1.0)
+        return p;
+
+    const size_t i = static_cast<size_t>(position);
+    const float mu = position - i;
+    const entry & a = table[i];
+    const entry & b = table[i + 1];
+
+    p.tabulated = true;
+    p.range_numerator = a.range_numerator
+        + mu * (b.range_numerator - a.range_numerator);
+    p.cos_sum = a.cos_sum + mu * (b.cos_sum - a.cos_sum);
+    p.sin_sum = a.sin_sum + mu * (b.sin_sum - a.sin_sum);
+    return p;
+}
+
+/*
+ * Height of the beam center above the ground at the given central angle
+ * from the site, in meters, at the reference elevation. The elevation
+ * barely varies around a cut, so this does for the whole of it.
+ */
+float
+beam_geometry::beam_height(const double central_angle) const
+{
+    const double position = central_angle / step;
+    if (position >= table.size() - 1.0)
+        return exact_beam_height(central_angle,
+                to_rad(static_cast<double>(elevation_0_deg)));
+
+    const size_t i = static_cast<size_t>(position);
+    const float mu = position - i;
+    return table[i].height + mu * (table[i + 1].height - table[i].height);
+}
+
+} // namespace tile_generator
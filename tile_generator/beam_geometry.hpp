@@ -0,0 +1,120 @@
+#ifndef RSME_INCLUDED_BEAM_GEOMETRY_HPP
+#define RSME_INCLUDED_BEAM_GEOMETRY_HPP
+
+#include <vector>
+#include <cmath>
+
+#include "geo_math.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+using base_extract::simple_cut;
+
+/*
+ * Spacing of the beam geometry table along the ground, in meters. Linear
+ * interpolation between entries this close is good to well under a
+ * millimeter of slant range at any elevation a VCP uses.
+ */
+const double BEAM_GEOMETRY_STEP_METERS = 250.0;
+
+/*
+ * Largest difference from the reference elevation, in degrees, that the
+ * table's per-radial correction is used for. Radials further off than that
+ * are worked out exactly.
+ */
+const float BEAM_GEOMETRY_MAX_CORRECTION_DEG = 0.5;
+
+/*
+ * A central angle looked up in a beam_geometry, ready to give the slant
+ * range along any radial of the cut.
+ */
+struct beam_position
+{
+    double central_angle;
+    bool tabulated;
+    float range_numerator;
+    float cos_sum, sin_sum;
+};
+
+/*
+ * The geometry of a cut's beam, tabulated against central angle from the
+ * site so that the sampler doesn't have to do the trig for every radial of
+ * every kernel.
+ *
+ * The slant range to a central angle phi along a beam at elevation theta is
+ * R sin(phi) / cos(theta + phi). The table holds R sin(phi) and the sine and
+ * cosine of theta_0 + phi at the elevation of the cut's first radial. The
+ * elevation wanders a little from radial to radial, so each radial's own
+ * difference d from theta_0 is put back with
+ *
+ *   cos(theta_0 + d + phi) = cos(theta_0 + phi) cos(d)
+ *                            - sin(theta_0 + phi) sin(d)
+ *
+ * with cos(d) and sin(d) from the first terms of their series, which are
+ * exact to float precision for the fraction of a degree d ever is. Every
+ * radial under a filter kernel is at the same central angle, so the table
+ * is looked up once with locate(), and only the correction is left to do
+ * per radial.
+ *
+ * Past the end of the table, which reaches just beyond the longest radial,
+ * or for a radial too far off the reference elevation, the slant range is
+ * worked out exactly. A default constructed geometry has no table, so it
+ * always works it out exactly.
+ */
+class beam_geometry
+{
+public:
+    beam_geometry(void);
+    explicit beam_geometry(const simple_cut & cut);
+
+    beam_position locate(const double central_angle) const;
+    float slant_range(const beam_position & position,
+            const float elevation_deg) const;
+    float slant_range(const double central_angle,
+            const float elevation_deg) const
+        { return slant_range(locate(central_angle), elevation_deg); }
+    float beam_height(const double central_angle) const;
+
+    float reference_elevation_deg(void) const
+        { return elevation_0_deg; }
+
+private:
+    struct entry
+    {
+        float range_numerator;      // R sin(phi)
+        float cos_sum, sin_sum;     // cos(theta_0 + phi), sin(theta_0 + phi)
+        float height;               // Beam height at theta_0, in meters
+    };
+
+    float elevation_0_deg;
+    double step;                    // Radians of central angle per entry
+    std::vector<entry> table;
+};
+
+/*
+ * Slant range in meters along the beam of a radial at the given elevation,
+ * directly above a central angle from the site, as inclined_slant_range()
+ * works it out.
+ */
+inline
+float
+beam_geometry::slant_range(const beam_position & position,
+        const float elevation_deg) const
+{
+    const float d_deg = elevation_deg - elevation_0_deg;
+    if (!position.tabulated
+            || std::fabs(d_deg) > BEAM_GEOMETRY_MAX_CORRECTION_DEG)
+        return inclined_slant_range(position.central_angle,
+                to_rad(static_cast<double>(elevation_deg)));
+
+    const float d = to_rad(d_deg);
+    const float d2 = d * d;
+    return position.range_numerator
+        / (position.cos_sum * (1.0f - d2 / 2.0f)
+            - position.sin_sum * d * (1.0f - d2 / 6.0f));
+}
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_BEAM_GEOMETRY_HPP
@@ -9,12 +9,12 @@
 namespace tile_generator {
 
 /*
- * Test to see if a particular tile intersects a circle of the radius given in
- * meters centered on a site given as lat/lon in radians.
+ * Find the point on a tile closest to a site given as lat/lon in radians. The
+ * result is a lat/lon in radians.
  */
-bool
-test_tile_intersection(const long t_x, const long t_y, const int zoom_level,
-        const double lat, const double lon, const double distance)
+double_pair_t
+closest_tile_point(const long t_x, const long t_y, const int zoom_level,
+        const double lat, const double lon)
 {
     using boost::tuples::tie;
 
@@ -33,18 +33,18 @@ test_tile_intersection(const long t_x, const long t_y, const int zoom_level,
      *
      *  A. Cases 1, 2, 4, and 5 are corner sections. Ex: The northern and
      *     southern extents of the tile are north of the site, and the eastern
-     *     and western extents are both east. Test the distance of the
+     *     and western extents are both east. The closest point is the
      *     southwest corner.
      *
      *  B. Cases 3, 6, 7, and 8 are side sections. Ex: The northern and
      *     southern extents of the tile are north of the point, but the tile's
-     *     east and west extents straddle the point's longitude. Test the
-     *     distance of a point with the same longitude of the site, but at the
-     *     southern latitude of the tile.
+     *     east and west extents straddle the point's longitude. The closest
+     *     point has the same longitude of the site, but is at the southern
+     *     latitude of the tile.
      *
      *  C. Case 9 is the center section. The tile straddles the site in both
      *     latitude and longitude, meaning the site itself is actually on the
-     *     tile; return true.
+     *     tile.
      */
 
     const bool all_north = north > lat && south > lat;
@@ -55,32 +55,53 @@ test_tile_intersection(const long t_x, const long t_y, const int zoom_level,
     if (all_north)
     {
         if (all_east)
-            return great_circle_distance(lat, lon, south, west) < distance;
+            return double_pair_t(south, west);
         else if (all_west)
-            return great_circle_distance(lat, lon, south, east) < distance;
+            return double_pair_t(south, east);
         else
-            return great_circle_distance(lat, lon, south, lon) < distance;
+            return double_pair_t(south, lon);
     }
     else if (all_south)
     {
         if (all_east)
-            return great_circle_distance(lat, lon, north, west) < distance;
+            return double_pair_t(north, west);
         else if (all_west)
-            return great_circle_distance(lat, lon, north, east) < distance;
+            return double_pair_t(north, east);
         else
-            return great_circle_distance(lat, lon, north, lon) < distance;
+            return double_pair_t(north, lon);
     }
     else
     {
         if (all_east)
-            return great_circle_distance(lat, lon, lat, west) < distance;
+            return double_pair_t(lat, west);
         else if (all_west)
-            return great_circle_distance(lat, lon, lat, east) < distance;
+            return double_pair_t(lat, east);
         else
-            return true;
+            return double_pair_t(lat, lon);
     }
 }
 
+/*
+ * Test to see if a particular tile intersects a circle of the radius given in
+ * meters centered on a site given as lat/lon in radians.
+ */
+bool
+test_tile_intersection(const long t_x, const long t_y, const int zoom_level,
+        const double lat, const double lon, const double distance)
+{
+    using boost::tuples::tie;
+
+    // The site itself being on the tile is the only case that needs no
+    // distance calculation.
+    double near_lat, near_lon;
+    tie(near_lat, near_lon) =
+        closest_tile_point(t_x, t_y, zoom_level, lat, lon);
+    if (near_lat == lat && near_lon == lon)
+        return true;
+
+    return great_circle_distance(lat, lon, near_lat, near_lon) < distance;
+}
+
 /*
  * Recursively find all the tiles satisfying test_tile_intersection(), starting
  * at the given tile and searching down to max_zoom_level.
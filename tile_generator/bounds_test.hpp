@@ -5,10 +5,14 @@
 #include <vector>
 #include <memory>
 
+#include "tile_coord.hpp"
+
 namespace tile_generator {
 
 typedef boost::tuple<long, long, int> tile_t;
 
+double_pair_t closest_tile_point(const long t_x, const long t_y,
+        const int zoom_level, const double lat, const double lon);
 bool test_tile_intersection(const long t_x, const long t_y,
         const int zoom_level, const double lat, const double lon,
         const double distance);
@@ -0,0 +1,455 @@
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <boost/tuple/tuple.hpp>
+
+#include "coverage.hpp"
+#include "sample_cut.hpp"
+#include "single_site_tile.hpp"
+#include "bounds_test.hpp"
+#include "tile_coord.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+coverage_summary::coverage_summary(const simple_cut & the_cut,
+        const float echo_threshold_dbz, const float full_threshold_dbz)
+    : cut(the_cut), angular_res_deg(0.0)
+{
+    if (cut.radials.empty())
+        return;
+
+    angular_res_deg = 360.0 / cut.radials.size();
+    radials.reserve(cut.radials.size());
+
+    simple_cut::radials_type::const_iterator iter;
+    for (iter = cut.radials.begin();
+            iter != cut.radials.end();
+            ++iter)
+    {
+        const simple_radial & rad = iter->second;
+
+        radials.push_back(radial_blocks());
+        radial_blocks & rb = radials.back();
+        rb.azimuth            = rad.azimuth;
+        rb.elevation          = rad.elevation;
+        rb.start_range_meters = rad.start_range_meters;
+        rb.range_res_meters   = rad.range_res_meters;
+        rb.gate_count         = rad.gates.size();
+        rb.any_echo           = false;
+        rb.blocks.resize(
+                (rb.gate_count + COVERAGE_BLOCK_GATES - 1)
+                / COVERAGE_BLOCK_GATES);
+
+        for (size_t b = 0;
+                b != rb.blocks.size();
+                ++b)
+        {
+            bool any = false, all = true;
+            for (int k = b * COVERAGE_BLOCK_GATES;
+                    k != static_cast<int>((b + 1) * COVERAGE_BLOCK_GATES)
+                        && k != rb.gate_count;
+                    ++k)
+            {
+                // Gate values 0 and 1 are no data and range folded, which
+                // gate_val() reads as an invalid zero.
+                const unsigned char gate = rad.gates[k];
+                const float z = (gate - rad.offset) / rad.scale;
+                const bool valid = (gate != 0 && gate != 1);
+
+                any = any || (valid && z > echo_threshold_dbz);
+                all = all && (valid && z >= full_threshold_dbz);
+            }
+
+            rb.blocks[b] = (any ? BLOCK_ANY_ECHO : 0)
+                | (all ? BLOCK_ALL_ECHO : 0);
+            rb.any_echo = rb.any_echo || any;
+        }
+    }
+}
+
+/*
+ * Slant range along the beam to a central angle from the site. Past the angle
+ * where the beam runs parallel to the ground the formula turns negative, but
+ * that is well beyond the end of any radial, so call it infinitely far.
+ */
+inline
+float
+beam_range(const double central_angle, const float elevation)
+{
+    static const double HALF_PI = 1.57079632679489661923;
+
+    if (central_angle + elevation >= HALF_PI)
+        return std::numeric_limits<float>::infinity();
+    else
+        return inclined_slant_range(central_angle, elevation);
+}
+
+/*
+ * Work out the part of a cut a tile's pixels can draw on.
+ */
+tile_footprint::tile_footprint(const simple_cut & cut,
+        const float angular_res_deg, const long t_x, const long t_y,
+        const int t_z)
+{
+    using boost::tie;
+
+    // Points spaced along each edge of the tile, for finding its extents in
+    // azimuth and range.
+    static const int EDGE_POINTS = 8;
+
+    const double site_lat = to_rad(cut.latitude);
+    const double site_lon = to_rad(cut.longitude);
+    const double TDP = static_cast<double>(TILE_DIMENSION_PIXELS);
+    // The filter is widest in the row of pixels nearest the equator.
+    const float filter_width_meters = std::max(
+            pixel_height_meters(t_y, 0.0, t_z),
+            pixel_height_meters(t_y, TDP - 1.0, t_z));
+
+    // Nearest point of the tile, which is where the azimuth kernel is widest.
+    double near_lat, near_lon;
+    tie(near_lat, near_lon) =
+        closest_tile_point(t_x, t_y, t_z, site_lat, site_lon);
+    site_on_tile = (near_lat == site_lat && near_lon == site_lon);
+    near_angle = central_angle(site_lat, site_lon, near_lat, near_lon);
+
+    // Farthest point and bearings around the edge. The farthest point is
+    // where the range kernel is widest.
+    std::vector<float> bearings;
+    double far_lat = site_lat, far_lon = site_lon;
+    far_angle = 0.0;
+    for (int i = 0;
+            i != EDGE_POINTS * 4;
+            ++i)
+    {
+        const double s = TDP * (i % EDGE_POINTS) / EDGE_POINTS;
+        double d_x, d_y;
+        switch (i / EDGE_POINTS)
+        {
+            case 0:  d_x = s;         d_y = 0.0;       break;
+            case 1:  d_x = TDP;       d_y = s;         break;
+            case 2:  d_x = TDP - s;   d_y = TDP;       break;
+            default: d_x = 0.0;       d_y = TDP - s;   break;
+        }
+
+        double lat, lon;
+        tie(lat, lon) = pixel_mercator_to_latlon(t_x, t_y, d_x, d_y, t_z);
+
+        const double angle = central_angle(site_lat, site_lon, lat, lon);
+        if (angle > far_angle)
+        {
+            far_angle = angle;
+            far_lat = lat;
+            far_lon = lon;
+        }
+        bearings.push_back(initial_bearing_deg(site_lat, site_lon, lat, lon));
+    }
+
+    // Widen the footprint by the kernel's washout, plus one more kernel width
+    // for the blurring done by the pyramid levels, plus the spacing of the
+    // bounding gates and radials.
+    const kernel_geometry far_kg = calculate_kernel_geometry(cut, far_lat,
+            far_lon, filter_width_meters);
+    range_margin = (WASHOUT_ALLOWANCE + 1.0) * far_kg.range_filter_width;
+
+    // The tile's azimuth extent is the circle less the biggest gap between
+    // the edge bearings.
+    all_azimuths = site_on_tile;
+    az_start = 0.0;
+    az_extent = 360.0;
+    az_filter_scale = 0.0;
+    if (!all_azimuths)
+    {
+        std::sort(bearings.begin(), bearings.end());
+        float gap = clockwise_deg(bearings.back(), bearings.front());
+        az_start = bearings.front();
+        for (size_t i = 1;
+                i != bearings.size();
+                ++i)
+        {
+            const float g = bearings[i] - bearings[i - 1];
+            if (g > gap)
+            {
+                gap = g;
+                az_start = bearings[i];
+            }
+        }
+
+        const kernel_geometry near_kg = calculate_kernel_geometry(cut,
+                near_lat, near_lon, filter_width_meters);
+        az_filter_scale = near_kg.az_filter_scale;
+        const float az_margin = (WASHOUT_ALLOWANCE + 1.0) * az_filter_scale
+            + 2.0 * angular_res_deg;
+
+        az_extent = 360.0 - gap + 2.0 * az_margin;
+        az_start -= az_margin;
+        all_azimuths = (az_extent >= 360.0);
+    }
+}
+
+bool
+tile_footprint::covers(const float azimuth) const
+{
+    return all_azimuths || clockwise_deg(az_start, azimuth) <= az_extent;
+}
+
+/*
+ * Find the gates of a radial the tile can draw on, clamped to the radial.
+ * Returns false if any of the footprint falls off either end of the radial,
+ * where it's invalid but still takes the value of the end gate.
+ */
+bool
+tile_footprint::gate_span(const float elevation_deg,
+        const float start_range_meters, const float range_res_meters,
+        const int gate_count, int & near_gate, int & far_gate) const
+{
+    const float elev = to_rad(elevation_deg);
+    const float margin = range_margin + 2.0 * range_res_meters;
+    const float near_range = (site_on_tile
+            ? 0.0
+            : beam_range(near_angle, elev)) - margin;
+    const float far_range = beam_range(far_angle, elev) + margin;
+
+    const float near_pos =
+        (near_range - start_range_meters) / range_res_meters;
+    const float far_pos =
+        (far_range - start_range_meters) / range_res_meters;
+
+    near_gate = (near_pos > 0.0
+            ? (near_pos < gate_count - 1
+                ? static_cast<int>(std::floor(near_pos))
+                : gate_count - 1)
+            : 0);
+    far_gate = (far_pos < gate_count - 1
+            ? static_cast<int>(std::ceil(far_pos))
+            : gate_count - 1);
+
+    return !(near_pos < 0.0 || !(far_pos < gate_count - 1));
+}
+
+tile_coverage
+coverage_summary::classify(const long t_x, const long t_y,
+        const int t_z) const
+{
+    if (radials.empty())
+        return COVERAGE_EMPTY;
+
+    const tile_footprint footprint(cut, angular_res_deg, t_x, t_y, t_z);
+
+    bool any = false, all = true;
+    std::vector<radial_blocks>::const_iterator iter;
+    for (iter = radials.begin();
+            iter != radials.end();
+            ++iter)
+    {
+        const radial_blocks & rb = *iter;
+        if (!footprint.covers(rb.azimuth))
+            continue;
+
+        int near_gate, far_gate;
+        if (!footprint.gate_span(rb.elevation, rb.start_range_meters,
+                    rb.range_res_meters, rb.gate_count, near_gate, far_gate))
+            all = false;
+        if (!rb.any_echo && !all)
+            continue;
+
+        const int first_block = near_gate / COVERAGE_BLOCK_GATES;
+        const int last_block = far_gate / COVERAGE_BLOCK_GATES;
+
+        for (int b = first_block;
+                b <= last_block;
+                ++b)
+        {
+            any = any || (rb.blocks[b] & BLOCK_ANY_ECHO);
+            all = all && (rb.blocks[b] & BLOCK_ALL_ECHO);
+        }
+
+        if (any && !all)
+            return COVERAGE_PARTIAL;
+    }
+
+    if (!any)
+        return COVERAGE_EMPTY;
+    else if (all)
+        return COVERAGE_FULL;
+    else
+        return COVERAGE_PARTIAL;
+}
+
+/*
+ * Whether two radials' gates are laid out and scaled the same, up to a
+ * little jitter in elevation, so their gates can be compared one for one.
+ */
+bool
+same_gate_layout(const simple_radial & a, const simple_radial & b)
+{
+    return std::fabs(a.elevation - b.elevation) <= CHANGE_ELEVATION_JITTER_DEG
+        && a.start_range_meters == b.start_range_meters
+        && a.range_res_meters == b.range_res_meters
+        && a.scale == b.scale && a.offset == b.offset;
+}
+
+/*
+ * Angle between two azimuths, in degrees, from 0 to 180.
+ */
+float
+azimuth_difference(const float a, const float b)
+{
+    const float d = std::fabs(a - b);
+    return (d > 180.0 ? 360.0 - d : d);
+}
+
+/*
+ * The radial of a cut nearest the given azimuth, or end() if there is none
+ * within max_difference_deg of it.
+ */
+simple_cut::radials_type::const_iterator
+nearest_radial(const simple_cut & cut, const float azimuth,
+        const float max_difference_deg)
+{
+    if (cut.radials.empty())
+        return cut.radials.end();
+
+    simple_cut::radials_type::const_iterator lower, upper;
+    boost::tie(lower, upper) = bounding_pair(cut.radials, azimuth);
+    if (upper == cut.radials.end())
+        upper = cut.radials.begin();
+    if (lower == cut.radials.end())
+        --lower;
+
+    const float to_lower = azimuth_difference(azimuth, lower->first);
+    const float to_upper = azimuth_difference(azimuth, upper->first);
+    if (std::min(to_lower, to_upper) > max_difference_deg)
+        return cut.radials.end();
+    return (to_lower <= to_upper ? lower : upper);
+}
+
+change_summary::change_summary(const simple_cut & previous,
+        const simple_cut & current)
+    : cut(current), angular_res_deg(0.0), everything(false),
+        changed_count(0), total_count(0)
+{
+    if (cut.radials.empty())
+        return;
+
+    angular_res_deg = 360.0 / cut.radials.size();
+    everything = (previous.latitude != cut.latitude
+            || previous.longitude != cut.longitude
+            || previous.radials.empty());
+    radials.reserve(cut.radials.size());
+
+    // Which of the previous cut's radials some radial of this one was
+    // compared against.
+    std::vector<bool> paired(previous.radials.size(), false);
+
+    simple_cut::radials_type::const_iterator iter;
+    for (iter = cut.radials.begin();
+            iter != cut.radials.end();
+            ++iter)
+    {
+        const simple_radial & rad = iter->second;
+
+        radials.push_back(radial_changes());
+        radial_changes & rc = radials.back();
+        rc.azimuth            = rad.azimuth;
+        rc.elevation          = rad.elevation;
+        rc.start_range_meters = rad.start_range_meters;
+        rc.range_res_meters   = rad.range_res_meters;
+        rc.gate_count         = rad.gates.size();
+        rc.any_changed        = false;
+        rc.blocks.resize(
+                (rc.gate_count + COVERAGE_BLOCK_GATES - 1)
+                / COVERAGE_BLOCK_GATES, true);
+        total_count += rc.blocks.size();
+
+        if (everything)
+            continue;
+
+        // Pair the radial up with the previous cut's radial nearest it, if
+        // that is close enough to stand for it. Otherwise, all of it is new.
+        const simple_cut::radials_type::const_iterator prev_iter =
+            nearest_radial(previous, iter->first, angular_res_deg / 2.0);
+        if (prev_iter == previous.radials.end()
+                || !same_gate_layout(prev_iter->second, rad))
+            continue;
+
+        paired[prev_iter - previous.radials.begin()] = true;
+        const simple_radial & prev = prev_iter->second;
+        const int prev_gate_count = prev.gates.size();
+        for (size_t b = 0;
+                b != rc.blocks.size();
+                ++b)
+        {
+            const int first = b * COVERAGE_BLOCK_GATES;
+            const int last = std::min(first + COVERAGE_BLOCK_GATES,
+                    rc.gate_count);
+            rc.blocks[b] = (last > prev_gate_count
+                    || !std::equal(rad.gates.begin() + first,
+                        rad.gates.begin() + last,
+                        prev.gates.begin() + first));
+        }
+    }
+
+    // A radial of the previous cut that nothing was paired with, one more
+    // than this cut has, say, was drawn in tiles that its nearest radial
+    // here has to redraw.
+    if (!everything)
+    {
+        simple_cut::radials_type::const_iterator prev_iter;
+        for (prev_iter = previous.radials.begin();
+                prev_iter != previous.radials.end();
+                ++prev_iter)
+        {
+            if (paired[prev_iter - previous.radials.begin()])
+                continue;
+            iter = nearest_radial(cut, prev_iter->first, 180.0);
+            radial_changes & rc = radials[iter - cut.radials.begin()];
+            std::fill(rc.blocks.begin(), rc.blocks.end(), true);
+        }
+    }
+
+    std::vector<radial_changes>::iterator rc_iter;
+    for (rc_iter = radials.begin();
+            rc_iter != radials.end();
+            ++rc_iter)
+    {
+        const size_t count = std::count(rc_iter->blocks.begin(),
+                rc_iter->blocks.end(), true);
+        rc_iter->any_changed = (count != 0);
+        changed_count += count;
+    }
+}
+
+bool
+change_summary::changed(const long t_x, const long t_y, const int t_z) const
+{
+    if (everything)
+        return true;
+
+    const tile_footprint footprint(cut, angular_res_deg, t_x, t_y, t_z);
+
+    std::vector<radial_changes>::const_iterator iter;
+    for (iter = radials.begin();
+            iter != radials.end();
+            ++iter)
+    {
+        const radial_changes & rc = *iter;
+        if (!rc.any_changed || !footprint.covers(rc.azimuth))
+            continue;
+
+        int near_gate, far_gate;
+        footprint.gate_span(rc.elevation, rc.start_range_meters,
+                rc.range_res_meters, rc.gate_count, near_gate, far_gate);
+
+        for (int b = near_gate / COVERAGE_BLOCK_GATES;
+                b <= far_gate / COVERAGE_BLOCK_GATES;
+                ++b)
+            if (rc.blocks[b])
+                return true;
+    }
+
+    return false;
+}
+
+} // namespace tile_generator
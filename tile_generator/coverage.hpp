@@ -0,0 +1,172 @@
+#ifndef RSME_INCLUDED_COVERAGE_HPP
+#define RSME_INCLUDED_COVERAGE_HPP
+
+#include <vector>
+#include <cmath>
+
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+using base_extract::simple_cut;
+
+/*
+ * Reflectivity thresholds matching the colorized TMO. At or below the echo
+ * threshold a pixel is fully transparent, and at or above the full threshold
+ * it is visibly opaque wherever the data is valid.
+ */
+const float ECHO_THRESHOLD_DBZ = 0.0;
+const float FULL_ECHO_THRESHOLD_DBZ = 1.0;
+
+/*
+ * Number of gates summarized together along each radial.
+ */
+const int COVERAGE_BLOCK_GATES = 16;
+
+enum tile_coverage
+{
+    COVERAGE_EMPTY,     // No pixel can come out significant
+    COVERAGE_PARTIAL,   // Can't tell without sampling
+    COVERAGE_FULL       // Every pixel will come out significant
+};
+
+/*
+ * Angular difference from a to b going clockwise, in [0, 360).
+ */
+inline
+float
+clockwise_deg(const float a, const float b)
+{
+    const float d = std::fmod(b - a, 360.0f);
+    return (d < 0.0 ? d + 360.0 : d);
+}
+
+/*
+ * The part of a cut that a tile's pixels can draw on: the azimuths and the
+ * range along each radial, widened by the reach of the sampling kernel (and
+ * then some, for the pyramid levels). Anything outside it can't affect how
+ * the tile renders.
+ */
+struct tile_footprint
+{
+    tile_footprint(const simple_cut & cut, const float angular_res_deg,
+            const long t_x, const long t_y, const int t_z);
+
+    bool covers(const float azimuth) const;
+    bool gate_span(const float elevation_deg, const float start_range_meters,
+            const float range_res_meters, const int gate_count,
+            int & near_gate, int & far_gate) const;
+
+    bool   site_on_tile;
+    double near_angle, far_angle;   // Central angles, radians
+    float  range_margin;            // Meters
+    bool   all_azimuths;
+    float  az_start, az_extent;     // Degrees clockwise
+    float  az_filter_scale;         // Widest azimuth kernel, degrees
+};
+
+/*
+ * A coarse summary of where a cut has echo, used to find out whether a tile
+ * is worth sampling before touching any pixels. Each radial is cut into
+ * blocks of gates, and each block records whether any of its gates has echo
+ * and whether all of them do. A radial with no echo at all is flagged so it
+ * can be skipped outright.
+ *
+ * Classification is conservative. The tile's polar footprint is widened by
+ * the reach of the sampling kernel (and then some, for the pyramid levels),
+ * so a tile classified as empty really would have rendered fully
+ * transparent, and one classified as full really would have had every pixel
+ * significant.
+ */
+struct coverage_summary
+{
+    coverage_summary(const simple_cut & the_cut,
+            const float echo_threshold_dbz = ECHO_THRESHOLD_DBZ,
+            const float full_threshold_dbz = FULL_ECHO_THRESHOLD_DBZ);
+
+    tile_coverage classify(const long t_x, const long t_y,
+            const int t_z) const;
+
+private:
+    enum block_flags
+    {
+        BLOCK_ANY_ECHO = 1,
+        BLOCK_ALL_ECHO = 2
+    };
+
+    struct radial_blocks
+    {
+        float azimuth;
+        float elevation;
+        float start_range_meters;
+        float range_res_meters;
+        int   gate_count;
+        bool  any_echo;
+
+        std::vector<unsigned char> blocks;
+    };
+
+    const simple_cut & cut;
+    float angular_res_deg;
+    std::vector<radial_blocks> radials;
+};
+
+/*
+ * How far apart in elevation two radials of the same cut in successive
+ * volumes can be and still be compared gate for gate. The antenna doesn't
+ * come back to quite the same angle each time round.
+ */
+const float CHANGE_ELEVATION_JITTER_DEG = 0.2;
+
+/*
+ * Where a cut differs from the previous cut of the same site, for rendering
+ * only the tiles a new volume actually changes. Successive volumes never
+ * repeat their radials' azimuths exactly, and often differ by a radial or
+ * so in how many there are, so each radial is paired up with the previous
+ * cut's radial nearest it within half a radial's width, and the two are
+ * compared in blocks of gates the same as the coverage summary. A block
+ * counts as changed if any of its gates differs at all, or if its radial
+ * has no pair with the same gate layout, or if it is past the end of its
+ * pair. A previous radial left without a pair counts as a change to the
+ * whole of the radial nearest it. If the site has moved, everything counts
+ * as changed.
+ *
+ * So a tile found unchanged has the same data to render from either cut,
+ * though not quite in the same places: the radials may have shifted round
+ * by up to half a radial's width, and keeping the old tile keeps them where
+ * they were.
+ */
+class change_summary
+{
+public:
+    change_summary(const simple_cut & previous, const simple_cut & current);
+
+    bool changed(const long t_x, const long t_y, const int t_z) const;
+
+    bool all_changed(void) const { return everything; }
+    size_t changed_blocks(void) const { return changed_count; }
+    size_t total_blocks(void) const { return total_count; }
+
+private:
+    struct radial_changes
+    {
+        float azimuth;
+        float elevation;
+        float start_range_meters;
+        float range_res_meters;
+        int   gate_count;
+        bool  any_changed;
+
+        std::vector<bool> blocks;
+    };
+
+    const simple_cut & cut;
+    float angular_res_deg;
+    bool everything;
+    size_t changed_count, total_count;
+    std::vector<radial_changes> radials;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_COVERAGE_HPP
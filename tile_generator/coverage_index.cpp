@@ -0,0 +1,153 @@
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+
+#include "coverage_index.hpp"
+#include "bounds_test.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+/*
+ * Build the index by walking each site's coverage down the quadtree, the
+ * same walk generate makes.
+ */
+coverage_index::coverage_index(const std::vector<indexed_site> & the_sites,
+        const int the_max_zoom)
+    : site_list(the_sites), index_zoom(the_max_zoom)
+{
+    if (site_list.size() > 0xffff)
+        throw coverage_index_error("too many sites to index");
+
+    for (size_t i = 0;
+            i != site_list.size();
+            ++i)
+    {
+        const indexed_site & site = site_list[i];
+        std::auto_ptr< std::vector<tile_t> > tiles =
+            find_intersecting_tiles(tile_t(0, 0, 0), to_rad(site.latitude),
+                    to_rad(site.longitude), COVERAGE_INDEX_RADIUS,
+                    index_zoom);
+
+        std::vector<tile_t>::const_iterator iter;
+        for (iter = tiles->begin();
+                iter != tiles->end();
+                ++iter)
+            cells[cell_key(boost::get<0>(*iter), boost::get<1>(*iter),
+                    boost::get<2>(*iter))].push_back(i);
+    }
+}
+
+/*
+ * Load an index saved by save().
+ */
+coverage_index::coverage_index(const std::string & filename)
+    : index_zoom(0)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::binary);
+    if (!ifs)
+        throw coverage_index_error(filename + ": " + std::strerror(errno));
+
+    std::map<boost::uint64_t, site_ids> sorted_cells;
+    try
+    {
+        boost::archive::binary_iarchive ia(ifs);
+        ia >> index_zoom;
+        ia >> site_list;
+        ia >> sorted_cells;
+    }
+    catch (std::exception & e)
+    {
+        throw coverage_index_error(filename + ": " + e.what());
+    }
+
+    cells.insert(sorted_cells.begin(), sorted_cells.end());
+}
+
+/*
+ * Save the index as a boost binary archive, like the base files. The cells
+ * go out sorted so the same sites always make the same file. It is written
+ * to filename.part and renamed into place, so a server starting up never
+ * loads half an index.
+ */
+void
+coverage_index::save(const std::string & filename) const
+{
+    const std::string part_name = filename + ".part";
+    {
+        std::ofstream ofs(part_name.c_str(), std::ios::binary);
+        if (!ofs)
+            throw coverage_index_error(part_name + ": "
+                    + std::strerror(errno));
+
+        const std::map<boost::uint64_t, site_ids> sorted_cells(
+                cells.begin(), cells.end());
+        boost::archive::binary_oarchive oa(ofs);
+        oa << index_zoom;
+        oa << site_list;
+        oa << sorted_cells;
+
+        ofs.flush();
+        if (!ofs)
+            throw coverage_index_error(part_name + ": write failed");
+    }
+
+    if (std::rename(part_name.c_str(), filename.c_str()) != 0)
+        throw coverage_index_error(filename + ": " + std::strerror(errno));
+}
+
+/*
+ * Find the sites whose coverage intersects a tile, in the order they were
+ * given to the index.
+ */
+void
+coverage_index::find(const long t_x, const long t_y, const int t_z,
+        std::vector<size_t> & found) const
+{
+    found.clear();
+
+    if (t_z <= index_zoom)
+    {
+        const cell_map::const_iterator cell =
+            cells.find(cell_key(t_x, t_y, t_z));
+        if (cell != cells.end())
+            found.assign(cell->second.begin(), cell->second.end());
+        return;
+    }
+
+    const int shift = t_z - index_zoom;
+    const cell_map::const_iterator cell =
+        cells.find(cell_key(t_x >> shift, t_y >> shift, index_zoom));
+    if (cell == cells.end())
+        return;
+
+    site_ids::const_iterator iter;
+    for (iter = cell->second.begin();
+            iter != cell->second.end();
+            ++iter)
+    {
+        const indexed_site & site = site_list[*iter];
+        if (test_tile_intersection(t_x, t_y, t_z, to_rad(site.latitude),
+                    to_rad(site.longitude), COVERAGE_INDEX_RADIUS))
+            found.push_back(*iter);
+    }
+}
+
+boost::uint64_t
+coverage_index::cell_key(const long t_x, const long t_y, const int t_z)
+{
+    return (boost::uint64_t(t_z) << 58) | (boost::uint64_t(t_x) << 29)
+        | boost::uint64_t(t_y);
+}
+
+} // namespace tile_generator
@@ -0,0 +1,108 @@
+#ifndef RSME_INCLUDED_COVERAGE_INDEX_HPP
+#define RSME_INCLUDED_COVERAGE_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+/*
+ * Radius of each site's coverage area, in meters, same as for single sites.
+ */
+const double COVERAGE_INDEX_RADIUS = 300000.0;
+
+/*
+ * Deepest zoom level the index lists sites for tile by tile. At zoom 10 a
+ * tile is about 40 km across, so a site's coverage spans a few hundred of
+ * them, and only a handful of sites ever share one.
+ */
+const int COVERAGE_INDEX_MAX_ZOOM = 10;
+
+class coverage_index_error : public std::exception
+{
+public:
+    explicit coverage_index_error(const std::string & the_message)
+        : message(the_message) { }
+    ~coverage_index_error() throw() { }
+
+    virtual const char * what(void) const throw()
+    {
+        return message.c_str();
+    }
+
+private:
+    std::string message;
+};
+
+/*
+ * Where a site is, which is all the index needs to know about it.
+ */
+struct indexed_site
+{
+    indexed_site() { }
+    indexed_site(const base_extract::simple_cut & cut)
+        : radar_identifier(cut.radar_identifier), latitude(cut.latitude),
+            longitude(cut.longitude) { }
+
+    template <typename Archive> void serialize(Archive & ar,
+            const unsigned int version);
+
+    std::string radar_identifier;
+    float       latitude;
+    float       longitude;
+};
+
+template <typename Archive>
+void
+indexed_site::serialize(Archive & ar, const unsigned int version)
+{
+    ar & radar_identifier;
+    ar & latitude;
+    ar & longitude;
+}
+
+/*
+ * Which sites' coverage intersects each tile, worked out once for every tile
+ * down to max_zoom so that finding the sites for a tile is a hash lookup
+ * rather than an intersection test against every site. Deeper tiles look up
+ * their ancestor at max_zoom and test only the few sites listed for it.
+ *
+ * Sites are referred to by their position in sites(). An index can be saved
+ * to a file and loaded back, so the serving side doesn't have to rebuild it.
+ * Lookups are safe from any number of threads.
+ */
+class coverage_index
+{
+public:
+    coverage_index(const std::vector<indexed_site> & the_sites,
+            const int the_max_zoom = COVERAGE_INDEX_MAX_ZOOM);
+    explicit coverage_index(const std::string & filename);
+
+    void save(const std::string & filename) const;
+
+    void find(const long t_x, const long t_y, const int t_z,
+            std::vector<size_t> & found) const;
+
+    const std::vector<indexed_site> & sites(void) const { return site_list; }
+    int max_zoom(void) const { return index_zoom; }
+
+private:
+    typedef std::vector<boost::uint16_t> site_ids;
+    typedef boost::unordered_map<boost::uint64_t, site_ids> cell_map;
+
+    static boost::uint64_t cell_key(const long t_x, const long t_y,
+            const int t_z);
+
+    std::vector<indexed_site> site_list;
+    int index_zoom;
+    cell_map cells;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_COVERAGE_INDEX_HPP
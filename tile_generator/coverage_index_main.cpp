@@ -0,0 +1,54 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <exception>
+
+#include "coverage_index.hpp"
+#include "site_cache.hpp"
+
+/*
+ * Builds the coverage index for a set of sites from their base files and
+ * saves it for tile-server --coverage-index.
+ */
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using namespace tile_generator;
+    cout.sync_with_stdio(false);
+
+    if (argc < 3)
+    {
+        cout << "usage: coverage-index <indexfile> <basefile>..."
+            << std::endl;
+        return 1;
+    }
+
+    std::vector<indexed_site> sites;
+    for (int i = 2;
+            i != argc;
+            ++i)
+    {
+        try
+        {
+            sites.push_back(indexed_site(read_cut(argv[i])));
+        }
+        catch (std::exception & e)
+        {
+            cout << argv[i] << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        const coverage_index index(sites);
+        index.save(argv[1]);
+    }
+    catch (std::exception & e)
+    {
+        cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <string>
+
+#include "cpu_dispatch.hpp"
+
+namespace tile_generator {
+
+/*
+ * The highest level the CPU and the operating system both support, the
+ * latter meaning it saves the wider registers on a context switch, which
+ * __builtin_cpu_supports() checks too.
+ */
+isa_level
+supported_isa_level(void)
+{
+#ifdef RSME_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512vl"))
+        return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+#endif
+    return ISA_SSE2;
+}
+
+isa_level active_level = supported_isa_level();
+
+/*
+ * The level the dispatched loops run at, which is the supported one unless
+ * it has been forced lower.
+ */
+isa_level
+active_isa_level(void)
+{
+    return active_level;
+}
+
+/*
+ * Run the dispatched loops at the given level from now on, for comparing
+ * the levels against each other. This has to happen before any rendering
+ * starts, since the threads rendering read the level without locking. A
+ * level the machine doesn't support is refused, rather than left to crash
+ * on the first instruction it doesn't have.
+ */
+void
+force_isa_level(const isa_level level)
+{
+    if (level > supported_isa_level())
+        throw cpu_dispatch_error(std::string("this machine doesn't support ")
+                + isa_level_name(level));
+    active_level = level;
+}
+
+const char *
+isa_level_name(const isa_level level)
+{
+    switch (level)
+    {
+    case ISA_AVX512:
+        return "avx512";
+    case ISA_AVX2:
+        return "avx2";
+    default:
+        return "sse2";
+    }
+}
+
+isa_level
+parse_isa_level(const std::string & name)
+{
+    if (name == "sse2")
+        return ISA_SSE2;
+    else if (name == "avx2")
+        return ISA_AVX2;
+    else if (name == "avx512")
+        return ISA_AVX512;
+    else
+        throw cpu_dispatch_error("unknown instruction set '" + name
+                + "', expected sse2, avx2 or avx512");
+}
+
+} // namespace tile_generator
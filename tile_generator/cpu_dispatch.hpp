@@ -0,0 +1,71 @@
+#ifndef RSME_INCLUDED_CPU_DISPATCH_HPP
+#define RSME_INCLUDED_CPU_DISPATCH_HPP
+
+#include <string>
+#include <exception>
+
+namespace tile_generator {
+
+/*
+ * Instruction set levels the inner loops are built for. The build itself
+ * only assumes what every x86-64 machine has, SSE2; each hot loop is also
+ * compiled for AVX2 and for AVX-512, and the version to run is picked when
+ * the program starts, from what the CPU it is running on supports.
+ */
+enum isa_level
+{
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_AVX512
+};
+
+/*
+ * Attributes to compile a function for one of the levels above. Anything
+ * inlined into such a function is compiled for that level along with it,
+ * so a loop written once as an inline function gets a version per level
+ * from three thin wrappers. Fused multiply-adds are kept out on purpose
+ * (the AVX-512 target implies FMA, so the build turns off contraction):
+ * fusing a multiply and an add rounds once instead of twice, and every
+ * level has to give the same answers as the baseline, bit for bit.
+ * A loop too big for the compiler to inline of its own accord is marked
+ * RSME_DISPATCH_INLINE, or the wrappers would all just call the one
+ * baseline copy of it. Compilers other than GCC and Clang, and other
+ * processors, only get the baseline.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RSME_CPU_DISPATCH 1
+#define RSME_TARGET_AVX2 __attribute__((target("avx2")))
+#define RSME_TARGET_AVX512 \
+    __attribute__((target("avx512f,avx512bw,avx512vl")))
+#define RSME_DISPATCH_INLINE inline __attribute__((always_inline))
+#else
+#define RSME_TARGET_AVX2
+#define RSME_TARGET_AVX512
+#define RSME_DISPATCH_INLINE inline
+#endif
+
+class cpu_dispatch_error : public std::exception
+{
+public:
+    explicit cpu_dispatch_error(const std::string & the_message)
+        : message(the_message) { }
+    ~cpu_dispatch_error() throw() { }
+
+    virtual const char * what(void) const throw()
+    {
+        return message.c_str();
+    }
+
+private:
+    std::string message;
+};
+
+isa_level supported_isa_level(void);
+isa_level active_isa_level(void);
+void force_isa_level(const isa_level level);
+const char * isa_level_name(const isa_level level);
+isa_level parse_isa_level(const std::string & name);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_CPU_DISPATCH_HPP
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "single_site_tile.hpp"
+#include "value_tile.hpp"
+#include "polar_pyramid.hpp"
+#include "coverage.hpp"
+#include "bounds_test.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+using namespace tile_generator;
+
+/*
+ * Differences seen so far between the two kernels.
+ */
+struct kernel_errors
+{
+    kernel_errors() : z(0.0), v(0.0), z_sum(0.0), pixels(0),
+        colors_differing(0) { }
+
+    double z;               // Largest, dBZ
+    double v;               // Largest, validity
+    double z_sum;           // For the mean
+    long pixels;
+    long colors_differing;
+};
+
+/*
+ * Checks the Gaussian's integer kernel against its floating point one:
+ * every pixel of every tile with echo on it at the given zoom levels is
+ * sampled both ways, and the largest differences in measurement and
+ * validity have to be within the documented bounds. Also counts how many
+ * pixels come out a different color, which is what the differences amount
+ * to in a colorized tile.
+ */
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using boost::format;
+    using boost::get;
+    cout.sync_with_stdio(false);
+
+    if (argc != 4)
+    {
+        cout << "usage: fixed-check <startzoom> <endzoom> <basefile>"
+            << std::endl;
+        return 1;
+    }
+
+    int start_zoom, end_zoom;
+    try
+    {
+        start_zoom = boost::lexical_cast<int>(argv[1]);
+        end_zoom = boost::lexical_cast<int>(argv[2]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad zoomlevel" << std::endl;
+        return 1;
+    }
+
+    simple_cut cut;
+    {
+        std::ifstream ifs(argv[3], std::ios::binary);
+        boost::archive::binary_iarchive ia(ifs);
+        ia >> cut;
+    }
+
+    const polar_pyramid pyramid(cut);
+    const coverage_summary coverage(cut);
+    const colorized_tmo<gil::rgba8_pixel_t> tmo;
+
+    std::vector<tile_t> tiles;
+    find_intersecting_tiles(0, 0, 0, to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, end_zoom, tiles);
+
+    sampling_options fixed_sampling;
+    fixed_sampling.fixed_point = true;
+
+    kernel_errors e;
+    value_tile float_values, fixed_values;
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+    {
+        long t_x, t_y;
+        int t_z;
+        boost::tie(t_x, t_y, t_z) = *iter;
+        if (t_z < start_zoom
+                || coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            continue;
+
+        sample_value_tile(pyramid, t_x, t_y, t_z, float_values);
+        sample_value_tile(pyramid, t_x, t_y, t_z, fixed_values,
+                fixed_sampling);
+
+        for (size_t i = 0;
+                i != float_values.values.size();
+                ++i)
+        {
+            const radar_value_t & a = float_values.values[i];
+            const radar_value_t & b = fixed_values.values[i];
+            const double z_error = std::fabs(a.first - b.first);
+            e.z = std::max(e.z, z_error);
+            e.v = std::max(e.v,
+                    static_cast<double>(std::fabs(a.second - b.second)));
+            e.z_sum += z_error;
+            ++e.pixels;
+            if (tmo(a) != tmo(b))
+                ++e.colors_differing;
+        }
+    }
+
+    cout << format("%1% pixels: measurement error %2$.4f dBZ (mean "
+            "%3$.5f), validity error %4$.5f, %5% pixels colored "
+            "differently\n")
+        % e.pixels % e.z % (e.pixels ? e.z_sum / e.pixels : 0.0) % e.v
+        % e.colors_differing;
+
+    if (e.z > FIXED_KERNEL_MAX_Z_ERROR_DBZ || e.v > FIXED_KERNEL_MAX_V_ERROR)
+    {
+        cout << "over the documented bound" << std::endl;
+        return 1;
+    }
+
+    cout << "within the documented bound" << std::endl;
+    return 0;
+}
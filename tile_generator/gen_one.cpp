@@ -7,8 +7,11 @@
 #include <boost/tuple/tuple.hpp>
 
 #include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
 #include "../base_extract/simple_cut.hpp"
 #include "bounds_test.hpp"
+#include "coverage.hpp"
+#include "batch_render.hpp"
 
 int main(int argc, char ** argv)
 {
@@ -18,10 +21,72 @@ int main(int argc, char ** argv)
     using namespace tile_generator;
     cout.sync_with_stdio(false);
 
-    if (argc != 6)
+    // Optional leading --threads N, to sample the tile on several cores, and
+    // --data, to write a data tile instead of a colorized one. --batch reads
+    // the arguments for many tiles, one tile per line, from a file or from
+    // stdin, and renders --threads N tiles at a time.
+    unsigned int threads = 1;
+    bool threads_given = false;
+    tile_format output_format = TILE_COLORIZED;
+    bool batch = false;
+    for (;;)
+    {
+        if (argc > 2 && std::string(argv[1]) == "--threads")
+        {
+            try
+            {
+                threads = boost::lexical_cast<unsigned int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad thread count" << std::endl;
+                return 1;
+            }
+            threads_given = true;
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--batch")
+        {
+            batch = true;
+            argc -= 1;
+            argv += 1;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--data")
+        {
+            output_format = TILE_DATA;
+            argc -= 1;
+            argv += 1;
+        }
+        else
+            break;
+    }
+
+    if (batch && argc <= 2)
+    {
+        // Default to a thread per core, rather than one, for batches.
+        const size_t batch_threads = (threads_given ? threads : 0);
+        if (argc == 2 && std::string(argv[1]) != "-")
+        {
+            std::ifstream ifs(argv[1]);
+            if (!ifs)
+            {
+                cout << "can't open " << argv[1] << std::endl;
+                return 1;
+            }
+            render_batch(ifs, cout, batch_threads, output_format);
+        }
+        else
+            render_batch(std::cin, cout, batch_threads, output_format);
+        return 0;
+    }
+
+    if (batch || argc != 6)
     {
         cout
-            << "usage: gen_one <basefile> <tx> <ty> <zoom> <outfile>"
+            << "usage: gen_one [--threads N] [--data] <basefile> <tx> <ty> "
+               "<zoom> <outfile>\n"
+               "       gen_one [--threads N] [--data] --batch [listfile]"
             << std::endl;
         return 1;
     }
@@ -49,7 +114,12 @@ int main(int argc, char ** argv)
     if (test_tile_intersection(t_x, t_y, t_z, to_rad(cut.latitude),
                 to_rad(cut.longitude), 300000.0))
     {
-        write_colorized_tile(cut, t_x, t_y, t_z, argv[5]);
+        // No need to build the pyramid for a tile with no echo on it.
+        if (coverage_summary(cut).classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            write_empty_tile(argv[5], output_format);
+        else
+            write_tile(polar_pyramid(cut), t_x, t_y, t_z, argv[5],
+                    output_format, threads);
         cout << "200\n";
     }
     else
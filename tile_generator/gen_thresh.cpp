@@ -10,8 +10,11 @@
 #include <boost/tuple/tuple.hpp>
 
 #include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
 #include "../base_extract/simple_cut.hpp"
 #include "bounds_test.hpp"
+#include "parallel_generate.hpp"
+#include "coverage.hpp"
 
 int main(int argc, char ** argv)
 {
@@ -21,9 +24,11 @@ int main(int argc, char ** argv)
     using namespace tile_generator;
     cout.sync_with_stdio(false);
 
-    if (argc != 4)
+    if (argc != 4 && argc != 5)
     {
-        cout << "usage: generate <basefile> <startzoom> <endzoom>" << std::endl;
+        cout
+            << "usage: generate <basefile> <startzoom> <endzoom> [threads]"
+            << std::endl;
         return 1;
     }
 
@@ -39,12 +44,41 @@ int main(int argc, char ** argv)
         return 1;
     }
 
+    // With a thread count (0 meaning one per core), walk the tile tree on a
+    // pool of threads instead of in the serial loop below.
+    int threads = -1;
+    if (argc == 5)
+    {
+        try
+        {
+            threads = boost::lexical_cast<int>(argv[4]);
+        }
+        catch (boost::bad_lexical_cast & e)
+        {
+            cout << "bad thread count" << std::endl;
+            return 1;
+        }
+    }
+
     simple_cut cut;
     {
         std::ifstream ifs(argv[1], std::ios::binary);
         boost::archive::binary_iarchive ia(ifs);
         ia >> cut;
     }
+    const polar_pyramid pyramid(cut);
+
+    if (threads >= 0)
+    {
+        generate_tiles_parallel(pyramid, start_zoom, end_zoom, true, threads);
+        return 0;
+    }
+
+    // Tiles with no echo on them all share one transparent tile, and aren't
+    // subdivided any further.
+    const coverage_summary coverage(cut);
+    const std::string empty_path = empty_tile_path(cut);
+    write_empty_tile(empty_path.c_str());
 
     std::deque<tile_t> tiles;
     std::vector<tile_t> new_tiles;
@@ -54,7 +88,6 @@ int main(int argc, char ** argv)
     while (!tiles.empty())
     {
         using boost::tie;
-        using boost::lexical_cast;
         using std::string;
         static const char * tile_fmt = "[%|4|:%|4|:%|4|] %|02| %|04| %|04|";
 
@@ -75,17 +108,23 @@ int main(int argc, char ** argv)
         }
         else
         {
-            string path = "out/"
-                + cut.radar_identifier + "_"
-                + lexical_cast<string>(t_z) + "_"
-                + lexical_cast<string>(t_x) + "-"
-                + lexical_cast<string>(t_y) + ".png";
+            const string path = tile_output_path(cut, t_x, t_y, t_z);
 
-            subdivide = write_colorized_tile(cut, t_x, t_y, t_z, path.c_str());
-            ++generated;
+            if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            {
+                link_empty_tile(empty_path, path);
+                subdivide = false;
+                cout << " bailing (no echo)" << std::endl;
+            }
+            else
+            {
+                subdivide = write_colorized_tile(pyramid, t_x, t_y, t_z,
+                        path.c_str());
 
-            if (!subdivide)
-                cout << " bailing (below threshold)" << std::endl;
+                if (!subdivide)
+                    cout << " bailing (below threshold)" << std::endl;
+            }
+            ++generated;
         }
 
         if (subdivide)
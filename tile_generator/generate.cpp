@@ -9,8 +9,14 @@
 #include <boost/tuple/tuple.hpp>
 
 #include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
 #include "../base_extract/simple_cut.hpp"
 #include "bounds_test.hpp"
+#include "parallel_generate.hpp"
+#include "coverage.hpp"
+#include "tile_output.hpp"
+#include "tile_store.hpp"
+#include "sampling_policy.hpp"
 
 int main(int argc, char ** argv)
 {
@@ -20,9 +26,112 @@ int main(int argc, char ** argv)
     using namespace tile_generator;
     cout.sync_with_stdio(false);
 
-    if (argc != 4)
+    // Optional leading --downsample N: only the end zoom level is sampled
+    // from the cut, and the levels above it are built by downsampling, except
+    // for zoom levels N and lower which are still sampled exactly.
+    //
+    // Optional leading --data: write data tiles for coloring on the client
+    // instead of colorized tiles.
+    //
+    // Optional leading --store: pack all the tiles into one tile store for
+    // the volume instead of writing a file per tile.
+    //
+    // Optional leading --since PREVBASE: only render the tiles that the
+    // changes since the previous volume's base file touch, and keep the rest
+    // as they were, under out/ or in the previous volume's store.
+    //
+    // Optional leading --metatile N: render each zoom level in blocks of N
+    // by N tiles that share their pixel geometry, METATILE_DEFAULT_SIZE if N
+    // is 0. Doesn't go with --downsample.
+    //
+    // Optional leading --sampling POLICY: how to sample each zoom level, as
+    // ZOOM:MODE entries (see sampling_policy). Everything gets the full
+    // Gaussian otherwise.
+    int exact_zoom = -1;
+    bool downsample = false;
+    int metatile_size = 0;
+    tile_format output_format = TILE_COLORIZED;
+    bool packed = false;
+    const char * previous_path = 0;
+    sampling_policy sampling;
+    for (;;)
     {
-        cout << "usage: generate <basefile> <startzoom> <endzoom>" << std::endl;
+        if (argc > 2 && std::string(argv[1]) == "--downsample")
+        {
+            try
+            {
+                exact_zoom = boost::lexical_cast<int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad zoomlevel" << std::endl;
+                return 1;
+            }
+            downsample = true;
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--metatile")
+        {
+            try
+            {
+                metatile_size = boost::lexical_cast<int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad metatile size" << std::endl;
+                return 1;
+            }
+            if (metatile_size <= 0)
+                metatile_size = METATILE_DEFAULT_SIZE;
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--data")
+        {
+            output_format = TILE_DATA;
+            argc -= 1;
+            argv += 1;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--store")
+        {
+            packed = true;
+            argc -= 1;
+            argv += 1;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--since")
+        {
+            previous_path = argv[2];
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--sampling")
+        {
+            try
+            {
+                sampling = sampling_policy(argv[2]);
+            }
+            catch (sampling_policy_error & e)
+            {
+                cout << e.what() << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else
+            break;
+    }
+
+    if (argc != 4 && argc != 5)
+    {
+        cout
+            << "usage: generate [--downsample <exactzoom>] [--data] [--store] "
+               "[--since <prevbasefile>]\n"
+               "                [--metatile <size>] "
+               "[--sampling <zoom>:<mode>[,...]]\n"
+               "                <basefile> <startzoom> <endzoom> [threads]"
+            << std::endl;
         return 1;
     }
 
@@ -38,43 +147,132 @@ int main(int argc, char ** argv)
         return 1;
     }
 
+    // With a thread count (0 meaning one per core), walk the tile tree on a
+    // pool of threads instead of in the serial loop below.
+    int threads = -1;
+    if (argc == 5)
+    {
+        try
+        {
+            threads = boost::lexical_cast<int>(argv[4]);
+        }
+        catch (boost::bad_lexical_cast & e)
+        {
+            cout << "bad thread count" << std::endl;
+            return 1;
+        }
+    }
+
     simple_cut cut;
     {
         std::ifstream ifs(argv[1], std::ios::binary);
         boost::archive::binary_iarchive ia(ifs);
         ia >> cut;
     }
+    const polar_pyramid pyramid(cut);
+
+    simple_cut previous_cut;
+    std::auto_ptr<change_summary> changes;
+    std::auto_ptr<tile_store_reader> previous_store;
+    if (previous_path)
+    {
+        {
+            std::ifstream ifs(previous_path, std::ios::binary);
+            boost::archive::binary_iarchive ia(ifs);
+            ia >> previous_cut;
+        }
+        changes.reset(new change_summary(previous_cut, cut));
+
+        if (packed)
+        {
+            try
+            {
+                previous_store.reset(new tile_store_reader(
+                            tile_store_path(previous_cut, output_format)));
+            }
+            catch (tile_store_error & e)
+            {
+                cout << e.what() << ", rendering everything" << std::endl;
+            }
+        }
+    }
 
-    std::auto_ptr< std::vector<tile_t> > tiles_p;
-    tiles_p = find_intersecting_tiles(tile_t(0, 0, 1), to_rad(cut.latitude),
-            to_rad(cut.longitude), 300000.0, end_zoom);
-    const std::vector<tile_t> & tiles(*tiles_p);
+    std::auto_ptr<tile_store_writer> store;
+    std::auto_ptr<tile_output> output_p;
+    if (packed)
+    {
+        store.reset(new tile_store_writer(tile_store_path(cut, output_format)));
+        output_p.reset(new tile_output(cut, output_format, *store,
+                    previous_store.get()));
+    }
+    else
+        output_p.reset(new tile_output(cut, output_format));
+    output_p->set_sampling(sampling);
+    const tile_output & output(*output_p);
 
-    std::vector<tile_t>::const_iterator tile_iter;
-    for (tile_iter = tiles.begin();
-            tile_iter != tiles.end();
-            ++tile_iter)
+    if (downsample)
+        generate_tiles_downsampled(pyramid, start_zoom, end_zoom, exact_zoom,
+                threads >= 0 ? threads : 1, output, changes.get());
+    else if (metatile_size > 0)
+        generate_tiles_metatiled(pyramid, start_zoom, end_zoom,
+                metatile_size, threads >= 0 ? threads : 1, output,
+                changes.get());
+    else if (threads >= 0)
+        generate_tiles_parallel(pyramid, start_zoom, end_zoom, false, threads,
+                output, changes.get());
+    else
     {
-        using boost::tie;
-        using boost::lexical_cast;
-        using std::string;
-
-        long t_x, t_y;
-        int t_z;
-        tie(t_x, t_y, t_z) = *tile_iter;
-
-        if (t_z < start_zoom)
-            continue;
-
-        string path = "out/"
-            + cut.radar_identifier + "_"
-            + lexical_cast<string>(t_z) + "_"
-            + lexical_cast<string>(t_x) + "-"
-            + lexical_cast<string>(t_y) + ".png";
-            
-        cout << path << std::endl;
-        write_colorized_tile(cut, t_x, t_y, t_z, path.c_str());
+        // Tiles with no echo on them all share one transparent tile.
+        const coverage_summary coverage(cut);
+
+        std::auto_ptr< std::vector<tile_t> > tiles_p;
+        tiles_p = find_intersecting_tiles(tile_t(0, 0, 1),
+                to_rad(cut.latitude), to_rad(cut.longitude), 300000.0,
+                end_zoom);
+        const std::vector<tile_t> & tiles(*tiles_p);
+
+        std::vector<tile_t>::const_iterator tile_iter;
+        for (tile_iter = tiles.begin();
+                tile_iter != tiles.end();
+                ++tile_iter)
+        {
+            using boost::tie;
+
+            long t_x, t_y;
+            int t_z;
+            tie(t_x, t_y, t_z) = *tile_iter;
+
+            if (t_z < start_zoom)
+                continue;
+
+            if (changes.get() && !changes->changed(t_x, t_y, t_z)
+                    && output.has_previous(t_x, t_y, t_z))
+            {
+                cout << output.name(t_x, t_y, t_z) << " unchanged"
+                    << std::endl;
+                output.keep(t_x, t_y, t_z);
+                continue;
+            }
+
+            cout << output.name(t_x, t_y, t_z) << std::endl;
+            if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+                output.put_empty(t_x, t_y, t_z);
+            else
+                output.render(pyramid, t_x, t_y, t_z);
+        }
     }
 
+    if (store.get())
+        store->finish();
+
+    if (changes.get())
+        cout << format("%1% of %2% gate blocks changed since %3%\n")
+            % changes->changed_blocks() % changes->total_blocks()
+            % previous_path;
+    cout << format("%1% tiles rendered, %2% of them identical to before; "
+            "%3% tiles unchanged and kept\n")
+        % output.rendered_count() % output.identical_count()
+        % output.kept_count() << std::flush;
+
     return 0;
 }
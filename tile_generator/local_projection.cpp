@@ -0,0 +1,251 @@
+#include <vector>
+#include <cmath>
+
+#include "local_projection.hpp"
+#include "tile_coord.hpp"
+#include "geo_math.hpp"
+#include "cpu_dispatch.hpp"
+
+namespace tile_generator {
+
+/*
+ * Arctangent of y/x in the right quadrant, in radians, as a polynomial in
+ * single precision. The polynomial (Abramowitz and Stegun 4.4.49) covers
+ * [0, 1], good to 2e-8 radians, and the rest is folded onto it with selects
+ * rather than branches so a loop of these can be vectorized.
+ */
+inline
+float
+approx_atan2(const float y, const float x)
+{
+    const float
+        a1 =  0.9999993329f,
+        a3 = -0.3332985605f,
+        a5 =  0.1994653599f,
+        a7 = -0.1390853351f,
+        a9 =  0.0964200441f,
+        a11 = -0.0559098861f,
+        a13 =  0.0218612288f,
+        a15 = -0.0040540580f;
+
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    const float lo = (ax < ay ? ax : ay);
+    const float hi = (ax < ay ? ay : ax);
+    const float a = (hi > 0.0f ? lo / hi : 0.0f);
+    const float s = a * a;
+
+    float r = a * (a1 + s * (a3 + s * (a5 + s * (a7 + s * (a9 + s * (a11
+                            + s * (a13 + s * a15)))))));
+    r = (ay > ax ? static_cast<float>(PI / 2.0) - r : r);
+    r = (x < 0.0f ? static_cast<float>(PI) - r : r);
+    return (y < 0.0f ? -r : r);
+}
+
+/*
+ * Arctangent of y/x for 0 <= y <= x / 10, which covers every central angle
+ * within the coverage radius, out to about 640 km. The leading terms of the
+ * series are good to 1e-10 radians there, and don't have the relative error
+ * the polynomial above has close to zero. Past that they are no good at
+ * all, so project_row() falls back on the polynomial.
+ */
+inline
+float
+small_atan2(const float y, const float x)
+{
+    const float a = y / x;
+    const float s = a * a;
+    return a * (1.0f + s * (-1.0f / 3.0f + s * (1.0f / 5.0f
+                    + s * (-1.0f / 7.0f))));
+}
+
+/*
+ * What the tangent plane formulas need to know about a latitude.
+ */
+struct projection_row
+{
+    float cos_lat;
+    float sin_dlat, cos_dlat;
+    float sin_lat_0_cos_lat, cos_lat_0_cos_lat;
+};
+
+projection_row
+make_projection_row(const double lat, const double lat_0,
+        const double sin_lat_0, const double cos_lat_0)
+{
+    const double cos_lat = std::cos(lat);
+    const projection_row row = {
+        static_cast<float>(cos_lat),
+        static_cast<float>(std::sin(lat - lat_0)),
+        static_cast<float>(std::cos(lat - lat_0)),
+        static_cast<float>(sin_lat_0 * cos_lat),
+        static_cast<float>(cos_lat_0 * cos_lat)
+    };
+    return row;
+}
+
+/*
+ * Locate a run of points sharing a latitude, given the sine and versine
+ * (1 - cos) of each one's difference in longitude from the site.
+ */
+inline
+void
+project_row(const projection_row & row, const float * sin_dlon,
+        const float * vers_dlon, const int count, float * theta_deg,
+        float * angular_distance)
+{
+    const float DEG_PER_RAD = static_cast<float>(180.0 / PI);
+
+    for (int i = 0;
+            i != count;
+            ++i)
+    {
+        const float east = row.cos_lat * sin_dlon[i];
+        const float north =
+            row.sin_dlat + row.sin_lat_0_cos_lat * vers_dlon[i];
+        const float up =
+            row.cos_dlat - row.cos_lat_0_cos_lat * vers_dlon[i];
+
+        const float theta = approx_atan2(east, north) * DEG_PER_RAD;
+        theta_deg[i] = (theta < 0.0f ? theta + 360.0f : theta);
+
+        // The whole of a low zoom tile can be far outside the coverage
+        // radius, even on the far side of the earth, where up goes
+        // negative. The series is only given arguments it holds for, so
+        // nothing out there divides by zero.
+        const float across = std::sqrt(east * east + north * north);
+        const bool near = (across <= up * 0.1f);
+        const float near_angle =
+            small_atan2((near ? across : 0.0f), (near ? up : 1.0f));
+        angular_distance[i] = (near ? near_angle : approx_atan2(across, up));
+    }
+}
+
+/*
+ * The same, built for each instruction set level, and picking the one for
+ * the active level.
+ */
+void
+project_row_sse2(const projection_row & row, const float * sin_dlon,
+        const float * vers_dlon, const int count, float * theta_deg,
+        float * angular_distance)
+{
+    project_row(row, sin_dlon, vers_dlon, count, theta_deg,
+            angular_distance);
+}
+
+RSME_TARGET_AVX2
+void
+project_row_avx2(const projection_row & row, const float * sin_dlon,
+        const float * vers_dlon, const int count, float * theta_deg,
+        float * angular_distance)
+{
+    project_row(row, sin_dlon, vers_dlon, count, theta_deg,
+            angular_distance);
+}
+
+RSME_TARGET_AVX512
+void
+project_row_avx512(const projection_row & row, const float * sin_dlon,
+        const float * vers_dlon, const int count, float * theta_deg,
+        float * angular_distance)
+{
+    project_row(row, sin_dlon, vers_dlon, count, theta_deg,
+            angular_distance);
+}
+
+void
+project_row_dispatched(const projection_row & row, const float * sin_dlon,
+        const float * vers_dlon, const int count, float * theta_deg,
+        float * angular_distance)
+{
+    switch (active_isa_level())
+    {
+    case ISA_AVX512:
+        project_row_avx512(row, sin_dlon, vers_dlon, count, theta_deg,
+                angular_distance);
+        break;
+    case ISA_AVX2:
+        project_row_avx2(row, sin_dlon, vers_dlon, count, theta_deg,
+                angular_distance);
+        break;
+    default:
+        project_row_sse2(row, sin_dlon, vers_dlon, count, theta_deg,
+                angular_distance);
+        break;
+    }
+}
+
+local_projection::local_projection(const double site_lat,
+        const double site_lon)
+    : lat_0(site_lat), lon_0(site_lon), sin_lat_0(std::sin(site_lat)),
+        cos_lat_0(std::cos(site_lat)) { }
+
+/*
+ * Locate one point, given in radians.
+ */
+polar_point
+local_projection::project(const double lat, const double lon) const
+{
+    const projection_row row =
+        make_projection_row(lat, lat_0, sin_lat_0, cos_lat_0);
+    const double half_dlon = (lon - lon_0) / 2.0;
+    const float sin_dlon = std::sin(lon - lon_0);
+    const float vers_dlon = 2.0 * std::sin(half_dlon) * std::sin(half_dlon);
+
+    float theta_deg, angular_distance;
+    project_row(row, &sin_dlon, &vers_dlon, 1, &theta_deg, &angular_distance);
+
+    polar_point point;
+    point.theta_deg = theta_deg;
+    point.angular_distance = angular_distance;
+    return point;
+}
+
+/*
+ * Locate the center of every pixel of a tile, a row at a time.
+ */
+void
+local_projection::project_tile(const long t_x, const long t_y,
+        const int t_z, projected_tile & out) const
+{
+    project_tile(pixel_grid(t_x, t_y, t_z), t_x, t_y, out);
+}
+
+/*
+ * Same as above, for a tile inside a block whose pixel grid has already
+ * been worked out.
+ */
+void
+local_projection::project_tile(const pixel_grid & grid, const long t_x,
+        const long t_y, projected_tile & out) const
+{
+    const int n = TILE_DIMENSION_PIXELS;
+    out.theta_deg.resize(n * n);
+    out.angular_distance.resize(n * n);
+
+    const double * lat = &grid.lat[(t_y - grid.t_y) * n];
+    const double * lon = &grid.lon[(t_x - grid.t_x) * n];
+
+    std::vector<float> sin_dlon(n), vers_dlon(n);
+    for (int x = 0;
+            x != n;
+            ++x)
+    {
+        const double dlon = lon[x] - lon_0;
+        sin_dlon[x] = std::sin(dlon);
+        vers_dlon[x] = 2.0 * std::sin(dlon / 2.0) * std::sin(dlon / 2.0);
+    }
+
+    for (int y = 0;
+            y != n;
+            ++y)
+    {
+        const projection_row row =
+            make_projection_row(lat[y], lat_0, sin_lat_0, cos_lat_0);
+
+        project_row_dispatched(row, &sin_dlon[0], &vers_dlon[0], n,
+                &out.theta_deg[y * n], &out.angular_distance[y * n]);
+    }
+}
+
+} // namespace tile_generator
@@ -0,0 +1,85 @@
+#ifndef RSME_INCLUDED_LOCAL_PROJECTION_HPP
+#define RSME_INCLUDED_LOCAL_PROJECTION_HPP
+
+#include <vector>
+
+#include "sample_cut.hpp"
+#include "tile_coord.hpp"
+
+namespace tile_generator {
+
+/*
+ * Largest error of local_projection against the exact double precision
+ * bearing and central angle, anywhere from 1 km to 300 km from a site
+ * between 60 degrees south and 60 degrees north, as measured by
+ * projection-check. The bearing error is also given as the distance across
+ * the beam it amounts to, since the error in degrees grows without bound
+ * right at the site.
+ */
+const double LOCAL_PROJECTION_MAX_RANGE_ERROR_METERS = 0.25;
+const double LOCAL_PROJECTION_MAX_BEARING_ERROR_DEG = 0.0001;
+const double LOCAL_PROJECTION_MAX_CROSS_RANGE_ERROR_METERS = 0.25;
+
+/*
+ * Largest error in the central angle of points beyond the coverage radius,
+ * out to the far side of the earth, as seen over whole tiles at zoom levels
+ * 0 to 4. A few meters, where all it has to do is put them out of range.
+ */
+const double LOCAL_PROJECTION_MAX_FAR_ANGLE_ERROR_RAD = 1e-6;
+
+/*
+ * The bearing and central angle of the center of every pixel of a tile, in
+ * row order, so pixel (x, y) is at y * TILE_DIMENSION_PIXELS + x.
+ */
+struct projected_tile
+{
+    std::vector<float> theta_deg;
+    std::vector<float> angular_distance;
+};
+
+/*
+ * Works out where points are as seen from a site faster than
+ * initial_bearing_deg() and central_angle() do it, by putting them in a
+ * plane tangent to the sphere at the site.
+ *
+ * A point's place in the tangent plane, (east, north, up) on the unit
+ * sphere, comes from the sine and cosine of its latitude and of its
+ * difference in longitude from the site:
+ *
+ *   east  = cos(lat) sin(dlon)
+ *   north = sin(lat - lat_0) + sin(lat_0) cos(lat) (1 - cos(dlon))
+ *   up    = cos(lat - lat_0) - cos(lat_0) cos(lat) (1 - cos(dlon))
+ *
+ * which is the azimuthal form of the usual formulas, rearranged so that
+ * nothing cancels at short range. The bearing is then atan2(east, north) and
+ * the central angle is atan2(hypot(east, north), up). That is exact on the
+ * sphere; what makes it fast is that across a tile, every pixel in a row
+ * has the same latitude and every pixel in a column the same longitude, so
+ * the trig is done once per row and column, and each pixel only takes a few
+ * multiplies, a square root, and two polynomial arctangents in single
+ * precision, which is where the error comes from. project_tile() runs over
+ * each row as one straight loop with no branches or calls, which the
+ * compiler turns into SIMD code, in a version for each instruction set
+ * level that cpu_dispatch picks between.
+ */
+class local_projection
+{
+public:
+    // The site, in radians.
+    local_projection(const double site_lat, const double site_lon);
+
+    polar_point project(const double lat, const double lon) const;
+
+    void project_tile(const long t_x, const long t_y, const int t_z,
+            projected_tile & out) const;
+    void project_tile(const pixel_grid & grid, const long t_x,
+            const long t_y, projected_tile & out) const;
+
+private:
+    double lat_0, lon_0;
+    double sin_lat_0, cos_lat_0;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_LOCAL_PROJECTION_HPP
@@ -0,0 +1,281 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <cmath>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "mosaic.hpp"
+#include "work_stealing_pool.hpp"
+#include "single_site_tile.hpp"
+#include "sample_cut.hpp"
+#include "coverage.hpp"
+#include "bounds_test.hpp"
+#include "tile_coord.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+/*
+ * A site whose coverage reaches a tile, with what the per-pixel blend needs
+ * to know about it worked out once for the whole tile.
+ */
+struct mosaic_candidate
+{
+    const loaded_site * site;
+    double lat, lon;        // Radians
+    bool empty;             // The coverage summary shows no echo on the tile
+};
+
+/*
+ * The sites that loaded, and where each of them is for the coverage index.
+ */
+loaded_sites_t
+present_sites(const loaded_sites_t & sites)
+{
+    loaded_sites_t present;
+    loaded_sites_t::const_iterator iter;
+    for (iter = sites.begin();
+            iter != sites.end();
+            ++iter)
+        if (*iter)
+            present.push_back(*iter);
+    return present;
+}
+
+std::vector<indexed_site>
+index_sites(const loaded_sites_t & sites)
+{
+    std::vector<indexed_site> indexed;
+    loaded_sites_t::const_iterator iter;
+    for (iter = sites.begin();
+            iter != sites.end();
+            ++iter)
+        indexed.push_back(indexed_site((*iter)->cut));
+    return indexed;
+}
+
+mosaic_sites::mosaic_sites(const loaded_sites_t & the_sites)
+    : sites(present_sites(the_sites)), index(index_sites(sites)) { }
+
+/*
+ * Find the sites whose coverage intersects a tile.
+ */
+void
+mosaic_sites::find(const long t_x, const long t_y, const int t_z,
+        std::vector<const loaded_site *> & found) const
+{
+    std::vector<size_t> ids;
+    index.find(t_x, t_y, t_z, ids);
+
+    found.clear();
+    std::vector<size_t>::const_iterator iter;
+    for (iter = ids.begin();
+            iter != ids.end();
+            ++iter)
+        found.push_back(sites[*iter].get());
+}
+
+/*
+ * Find the sites that reach a tile and work out what sampling them needs.
+ */
+void
+find_mosaic_candidates(const mosaic_sites & sites, const long t_x,
+        const long t_y, const int t_z,
+        std::vector<mosaic_candidate> & candidates)
+{
+    std::vector<const loaded_site *> found;
+    sites.find(t_x, t_y, t_z, found);
+
+    std::vector<const loaded_site *>::const_iterator iter;
+    for (iter = found.begin();
+            iter != found.end();
+            ++iter)
+    {
+        const loaded_site & site = **iter;
+        const simple_cut & cut = site.cut;
+        mosaic_candidate c;
+        c.site = &site;
+        c.lat = to_rad(cut.latitude);
+        c.lon = to_rad(cut.longitude);
+        c.empty = (site.coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY);
+        candidates.push_back(c);
+    }
+}
+
+/*
+ * Sample a tile of the mosaic into a value tile. Each pixel blends the sites
+ * whose coverage reaches it, weighted by how low their beams pass over it:
+ * the validities are averaged by weight, and the measurements by weight and
+ * validity, so a site with no valid data at a point doesn't drag the
+ * measurement of the others down. With only one site reaching a pixel, it
+ * comes out as that site alone would have sampled it.
+ */
+void
+sample_mosaic_tile(const std::vector<mosaic_candidate> & candidates,
+        const long t_x, const long t_y, const int t_z, value_tile & out)
+{
+    using boost::tie;
+
+    for (int y = 0;
+            y != TILE_DIMENSION_PIXELS;
+            ++y)
+    {
+        const float filter_width = pixel_height_meters(t_y, y, t_z);
+        for (int x = 0;
+                x != TILE_DIMENSION_PIXELS;
+                ++x)
+        {
+            double lat, lon;
+            tie(lat, lon) = pixel_mercator_to_latlon(t_x, t_y, x + 0.5,
+                    y + 0.5, t_z);
+
+            double z_sum = 0.0, v_sum = 0.0, w_sum = 0.0;
+            std::vector<mosaic_candidate>::const_iterator iter;
+            for (iter = candidates.begin();
+                    iter != candidates.end();
+                    ++iter)
+            {
+                const double angle = central_angle(iter->lat, iter->lon,
+                        lat, lon);
+                if (angle * MEAN_EARTH_RADIUS > MOSAIC_COVERAGE_RADIUS)
+                    continue;
+
+                const double h =
+                    iter->site->pyramid.beam.beam_height(angle)
+                    / MOSAIC_BEAM_HEIGHT_SCALE;
+                const double w = std::exp(-h * h);
+                const radar_value_t value = (iter->empty
+                        ? radar_value_t(0.0, 0.0)
+                        : sample_gaussian(iter->site->pyramid, lat, lon,
+                            filter_width));
+
+                z_sum += w * value.second * value.first;
+                v_sum += w * value.second;
+                w_sum += w;
+            }
+
+            if (v_sum > 0.0)
+                out(x, y) = radar_value_t(z_sum / v_sum, v_sum / w_sum);
+            else
+                out(x, y) = radar_value_t(0.0, 0.0);
+        }
+    }
+}
+
+void
+sample_mosaic_tile(const mosaic_sites & sites, const long t_x,
+        const long t_y, const int t_z, value_tile & out)
+{
+    std::vector<mosaic_candidate> candidates;
+    find_mosaic_candidates(sites, t_x, t_y, t_z, candidates);
+    sample_mosaic_tile(candidates, t_x, t_y, t_z, out);
+}
+
+typedef work_stealing_pool<tile_t> mosaic_pool_t;
+
+/*
+ * Renders one tile of the mosaic. A tile none of whose sites have any echo
+ * on it is put as the shared empty tile without sampling anything.
+ */
+struct mosaic_task
+{
+    mosaic_task(const mosaic_sites & the_sites,
+            const tile_output & the_output, boost::mutex & the_progress_mutex)
+        : sites(the_sites), output(the_output),
+            progress_mutex(the_progress_mutex) { }
+
+    void operator()(const tile_t & tile, mosaic_pool_t::worker &) const
+    {
+        using boost::tie;
+
+        long t_x, t_y;
+        int t_z;
+        tie(t_x, t_y, t_z) = tile;
+        const char * status = "";
+
+        std::vector<mosaic_candidate> candidates;
+        find_mosaic_candidates(sites, t_x, t_y, t_z, candidates);
+
+        bool empty = true;
+        std::vector<mosaic_candidate>::const_iterator iter;
+        for (iter = candidates.begin();
+                iter != candidates.end();
+                ++iter)
+            if (!iter->empty)
+                empty = false;
+
+        if (empty)
+        {
+            output.put_empty(t_x, t_y, t_z);
+            status = " empty (no echo)";
+        }
+        else
+        {
+            value_tile values;
+            sample_mosaic_tile(candidates, t_x, t_y, t_z, values);
+            output.put_value_tile(values, t_x, t_y, t_z);
+        }
+
+        const std::string name = output.name(t_x, t_y, t_z);
+        boost::lock_guard<boost::mutex> lock(progress_mutex);
+        std::cout << name << status << '\n' << std::flush;
+    }
+
+    const mosaic_sites & sites;
+    const tile_output & output;
+    boost::mutex & progress_mutex;
+};
+
+/*
+ * Render every tile from start_zoom to end_zoom that any site's coverage
+ * reaches, on a pool of threads. A thread count of zero uses one thread per
+ * hardware thread. The sites are loaded once up front, so the whole mosaic
+ * is rendered from memory.
+ */
+void
+generate_mosaic(const mosaic_sites & sites, const int start_zoom,
+        const int end_zoom, const size_t thread_count,
+        const tile_output & output)
+{
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    // Overlapping sites share tiles, and each tile is only rendered once.
+    std::set<tile_t> tiles;
+    loaded_sites_t::const_iterator site_iter;
+    for (site_iter = sites.sites.begin();
+            site_iter != sites.sites.end();
+            ++site_iter)
+    {
+        const simple_cut & cut = (*site_iter)->cut;
+        std::auto_ptr< std::vector<tile_t> > site_tiles =
+            find_intersecting_tiles(tile_t(0, 0, 1), to_rad(cut.latitude),
+                    to_rad(cut.longitude), MOSAIC_COVERAGE_RADIUS, end_zoom);
+
+        std::vector<tile_t>::const_iterator iter;
+        for (iter = site_tiles->begin();
+                iter != site_tiles->end();
+                ++iter)
+            if (boost::get<2>(*iter) >= start_zoom)
+                tiles.insert(*iter);
+    }
+
+    mosaic_pool_t pool(n);
+    boost::mutex progress_mutex;
+
+    std::set<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+        pool.push(*iter);
+    pool.run(mosaic_task(sites, output, progress_mutex));
+}
+
+} // namespace tile_generator
@@ -0,0 +1,55 @@
+#ifndef RSME_INCLUDED_MOSAIC_HPP
+#define RSME_INCLUDED_MOSAIC_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "site_cache.hpp"
+#include "coverage_index.hpp"
+#include "value_tile.hpp"
+#include "tile_output.hpp"
+
+namespace tile_generator {
+
+/*
+ * Radius of each site's coverage area, in meters, same as for single sites.
+ */
+const double MOSAIC_COVERAGE_RADIUS = COVERAGE_INDEX_RADIUS;
+
+/*
+ * Height of the beam center above the ground, in meters, at which a site's
+ * weight in the mosaic has fallen to 1/e. The lowest beam sees the most of
+ * what's actually near the ground, so where coverage overlaps, the site whose
+ * beam passes lowest over a point dominates it, and the handover from one
+ * site to the next happens smoothly, about halfway between them.
+ */
+const float MOSAIC_BEAM_HEIGHT_SCALE = 3000.0;
+
+/*
+ * The sites that make up a mosaic, with a coverage index over them for
+ * finding the ones that reach a tile. Sites that failed to load are left
+ * out.
+ */
+class mosaic_sites : boost::noncopyable
+{
+public:
+    explicit mosaic_sites(const loaded_sites_t & the_sites);
+
+    void find(const long t_x, const long t_y, const int t_z,
+            std::vector<const loaded_site *> & found) const;
+
+    const loaded_sites_t sites;
+    const coverage_index index;
+};
+
+void sample_mosaic_tile(const mosaic_sites & sites, const long t_x,
+        const long t_y, const int t_z, value_tile & out);
+void generate_mosaic(const mosaic_sites & sites, const int start_zoom,
+        const int end_zoom, const size_t thread_count,
+        const tile_output & output);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_MOSAIC_HPP
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+#include "mosaic.hpp"
+#include "site_cache.hpp"
+#include "tile_output.hpp"
+
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using namespace tile_generator;
+    cout.sync_with_stdio(false);
+
+    // Optional leading --threads N, for both loading the sites and rendering
+    // (the default is a thread per core), and --data, to write data tiles
+    // instead of colorized ones.
+    unsigned int threads = 0;
+    tile_format output_format = TILE_COLORIZED;
+    for (;;)
+    {
+        if (argc > 2 && std::string(argv[1]) == "--threads")
+        {
+            try
+            {
+                threads = boost::lexical_cast<unsigned int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad thread count" << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--data")
+        {
+            output_format = TILE_DATA;
+            argc -= 1;
+            argv += 1;
+        }
+        else
+            break;
+    }
+
+    if (argc < 5)
+    {
+        cout
+            << "usage: mosaic [--threads N] [--data] <name> <startzoom> "
+               "<endzoom> <basefile>..."
+            << std::endl;
+        return 1;
+    }
+
+    int start_zoom, end_zoom;
+    try
+    {
+        start_zoom = boost::lexical_cast<int>(argv[2]);
+        end_zoom = boost::lexical_cast<int>(argv[3]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad zoomlevel" << std::endl;
+        return 1;
+    }
+
+    // Sites that fail to load are reported and left out of the mosaic.
+    const std::vector<std::string> paths(argv + 4, argv + argc);
+    loaded_sites_t loaded;
+    load_sites(paths, loaded, threads);
+    const mosaic_sites sites(loaded);
+
+    const tile_output output(argv[1], output_format);
+    generate_mosaic(sites, start_zoom, end_zoom, threads, output);
+
+    return 0;
+}
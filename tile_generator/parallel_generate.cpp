@@ -0,0 +1,570 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <boost/format.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "parallel_generate.hpp"
+#include "work_stealing_pool.hpp"
+#include "single_site_tile.hpp"
+#include "value_tile.hpp"
+#include "coverage.hpp"
+#include "tile_output.hpp"
+#include "polar_pyramid.hpp"
+#include "bounds_test.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+typedef work_stealing_pool<tile_t> tile_pool_t;
+
+/*
+ * Whether a tile can be kept from the previous volume rather than rendered:
+ * nothing it draws on has changed, and the previous tile is there to keep.
+ */
+bool
+unchanged(const change_summary * changes, const tile_output & output,
+        const long t_x, const long t_y, const int t_z)
+{
+    return changes && !changes->changed(t_x, t_y, t_z)
+        && output.has_previous(t_x, t_y, t_z);
+}
+
+/*
+ * Renders one tile of the quadtree walk and pushes its children onto the
+ * worker's own deque. This is the body of the serial loops in generate and
+ * gen-thresh, so each tile is rendered exactly as it would be there.
+ */
+struct tile_task
+{
+    tile_task(const polar_pyramid & the_pyramid,
+            const coverage_summary & the_coverage,
+            const change_summary * the_changes, const int the_start_zoom,
+            const int the_end_zoom, const bool the_prune,
+            const tile_output & the_output, tile_pool_t & the_pool,
+            boost::mutex & the_progress_mutex)
+        : pyramid(the_pyramid), coverage(the_coverage),
+            changes(the_changes), start_zoom(the_start_zoom),
+            end_zoom(the_end_zoom), prune(the_prune), output(the_output),
+            pool(the_pool), progress_mutex(the_progress_mutex) { }
+
+    void operator()(const tile_t & tile, tile_pool_t::worker & w) const
+    {
+        using boost::tie;
+        using boost::format;
+        using std::string;
+        static const char * tile_fmt =
+            "[%|4|:%|4|:%|4|] %|02| %|04| %|04| (%|u|)";
+
+        const simple_cut & cut = pyramid.base;
+        long t_x, t_y;
+        int t_z;
+        tie(t_x, t_y, t_z) = tile;
+        bool subdivide = true;
+        const char * status = "";
+
+        if (t_z < start_zoom)
+            status = " skipped (underzoom)";
+        else if (unchanged(changes, output, t_x, t_y, t_z))
+        {
+            output.keep(t_x, t_y, t_z);
+            status = " unchanged";
+        }
+        else
+        {
+            if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            {
+                output.put_empty(t_x, t_y, t_z);
+                status = " empty (no echo)";
+                if (prune)
+                {
+                    subdivide = false;
+                    status = " bailing (no echo)";
+                }
+            }
+            else
+            {
+                const bool significant =
+                    output.render(pyramid, t_x, t_y, t_z);
+
+                if (prune && !significant)
+                {
+                    subdivide = false;
+                    status = " bailing (below threshold)";
+                }
+            }
+        }
+
+        if (subdivide)
+        {
+            if (t_z >= end_zoom)
+                status = " bailing (max zoom)";
+            else
+            {
+                std::vector<tile_t> new_tiles;
+                find_intersecting_tiles(t_x, t_y, t_z, to_rad(cut.latitude),
+                        to_rad(cut.longitude), 300000.0, t_z + 1, new_tiles);
+
+                // The first result is the tile we passed in.
+                std::vector<tile_t>::const_iterator iter;
+                if (!new_tiles.empty())
+                    for (iter = new_tiles.begin() + 1;
+                            iter != new_tiles.end();
+                            ++iter)
+                        w.push(*iter);
+            }
+        }
+
+        size_t done, outstanding;
+        pool.progress(done, outstanding);
+        const string line = (format(tile_fmt) % done % outstanding
+            % (done + outstanding) % t_z % t_x % t_y % w.index()).str();
+
+        boost::lock_guard<boost::mutex> lock(progress_mutex);
+        std::cout << line << status << '\n' << std::flush;
+    }
+
+    const polar_pyramid & pyramid;
+    const coverage_summary & coverage;
+    const change_summary * changes;
+    const int start_zoom, end_zoom;
+    const bool prune;
+    const tile_output & output;
+    tile_pool_t & pool;
+    boost::mutex & progress_mutex;
+};
+
+/*
+ * Walk the tile quadtree under (0, 0, 1) intersecting the site's coverage,
+ * rendering tiles from start_zoom to end_zoom on a pool of threads. If
+ * prune_insignificant is set, the children of tiles with no significant data
+ * are not visited, as in gen-thresh. A thread count of zero uses one thread
+ * per hardware thread.
+ *
+ * Tiles the coverage summary shows to have no echo on them are put as the
+ * shared empty tile instead of being rendered. Tiles are put in the output's
+ * format, with data tiles pruned by the same test as colorized ones.
+ *
+ * Given the changes since the previous volume, tiles they don't touch are
+ * kept from the previous volume instead. Kept tiles are never pruned.
+ */
+void
+generate_tiles_parallel(const polar_pyramid & pyramid, const int start_zoom,
+        const int end_zoom, const bool prune_insignificant,
+        const size_t thread_count, const tile_output & output,
+        const change_summary * changes)
+{
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    const coverage_summary coverage(pyramid.base);
+
+    tile_pool_t pool(n);
+    boost::mutex progress_mutex;
+
+    pool.push(tile_t(0, 0, 1));
+    pool.run(tile_task(pyramid, coverage, changes, start_zoom, end_zoom,
+                prune_insignificant, output, pool, progress_mutex));
+}
+
+/*
+ * Same as above, writing a file per tile under out/.
+ */
+void
+generate_tiles_parallel(const polar_pyramid & pyramid, const int start_zoom,
+        const int end_zoom, const bool prune_insignificant,
+        const size_t thread_count, const tile_format output_format)
+{
+    const tile_output output(pyramid.base, output_format);
+    generate_tiles_parallel(pyramid, start_zoom, end_zoom,
+            prune_insignificant, thread_count, output);
+}
+
+/*
+ * Put every tile of a subtree with no echo on it as the shared empty tile.
+ */
+void
+put_empty_subtree(const simple_cut & cut, const long t_x, const long t_y,
+        const int t_z, const int end_zoom, const tile_output & output,
+        boost::mutex & progress_mutex)
+{
+    std::vector<tile_t> tiles;
+    find_intersecting_tiles(t_x, t_y, t_z, to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, end_zoom, tiles);
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+    {
+        const long e_x = boost::get<0>(*iter), e_y = boost::get<1>(*iter);
+        const int e_z = boost::get<2>(*iter);
+        output.put_empty(e_x, e_y, e_z);
+
+        boost::lock_guard<boost::mutex> lock(progress_mutex);
+        std::cout << output.name(e_x, e_y, e_z) << " empty (no echo)\n"
+            << std::flush;
+    }
+}
+
+/*
+ * Keep every tile of a subtree from the previous volume, if the changes
+ * since then don't touch its root and every tile of it is there to keep.
+ * Nothing a tile's descendants draw on lies outside the tile's own
+ * footprint, so only the root needs checking for changes. Returns whether
+ * the subtree was kept.
+ */
+bool
+keep_unchanged_subtree(const simple_cut & cut, const change_summary * changes,
+        const long t_x, const long t_y, const int t_z, const int end_zoom,
+        const tile_output & output, boost::mutex & progress_mutex)
+{
+    if (!changes || changes->changed(t_x, t_y, t_z))
+        return false;
+
+    std::vector<tile_t> tiles;
+    find_intersecting_tiles(t_x, t_y, t_z, to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, end_zoom, tiles);
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+        if (!output.has_previous(boost::get<0>(*iter),
+                    boost::get<1>(*iter), boost::get<2>(*iter)))
+            return false;
+
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+    {
+        const long e_x = boost::get<0>(*iter), e_y = boost::get<1>(*iter);
+        const int e_z = boost::get<2>(*iter);
+        output.keep(e_x, e_y, e_z);
+
+        boost::lock_guard<boost::mutex> lock(progress_mutex);
+        std::cout << output.name(e_x, e_y, e_z) << " unchanged\n"
+            << std::flush;
+    }
+    return true;
+}
+
+/*
+ * Produce the values for a tile by rendering its subtree down to end_zoom and
+ * downsampling the children back up, writing every tile on the way. Only the
+ * tiles at end_zoom are sampled from the cut. A child quadrant outside the
+ * coverage area has no tiles to downsample, so that quadrant is sampled
+ * directly at this tile's zoom level, same as a full render would. A subtree
+ * with no echo on it is not rendered at all, its values are left blank and
+ * its tiles are put as the shared empty tile.
+ */
+void
+render_downsampled_subtree(const polar_pyramid & pyramid,
+        const coverage_summary & coverage, const long t_x, const long t_y,
+        const int t_z, const int end_zoom, const tile_output & output,
+        value_tile & out, boost::mutex & progress_mutex)
+{
+    const int HALF = TILE_DIMENSION_PIXELS / 2;
+    const simple_cut & cut = pyramid.base;
+
+    if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+    {
+        std::fill(out.values.begin(), out.values.end(),
+                radar_value_t(0.0, 0.0));
+        put_empty_subtree(cut, t_x, t_y, t_z, end_zoom, output,
+                progress_mutex);
+        return;
+    }
+
+    if (t_z >= end_zoom)
+        sample_value_tile(pyramid, t_x, t_y, t_z, out, output.sampling(t_z));
+    else
+    {
+        value_tile child;
+        for (int q = 0;
+                q != 4;
+                ++q)
+        {
+            const int q_x = q % 2, q_y = q / 2;
+            const long c_x = t_x * 2 + q_x, c_y = t_y * 2 + q_y;
+
+            if (test_tile_intersection(c_x, c_y, t_z + 1,
+                        to_rad(cut.latitude), to_rad(cut.longitude),
+                        300000.0))
+            {
+                render_downsampled_subtree(pyramid, coverage, c_x, c_y,
+                        t_z + 1, end_zoom, output, child,
+                        progress_mutex);
+                downsample_quadrant(child, q_x, q_y, out);
+            }
+            else
+                sample_value_tile(pyramid, t_x, t_y, t_z, out,
+                        output.sampling(t_z), q_x * HALF, q_y * HALF, HALF,
+                        HALF);
+        }
+    }
+
+    output.put_value_tile(out, t_x, t_y, t_z);
+
+    boost::lock_guard<boost::mutex> lock(progress_mutex);
+    std::cout << output.name(t_x, t_y, t_z) << '\n' << std::flush;
+}
+
+/*
+ * Task for the downsampling walk. Tiles above root_zoom are sampled directly
+ * from the cut, and tiles at root_zoom stand for their whole subtree.
+ */
+struct downsample_task
+{
+    downsample_task(const polar_pyramid & the_pyramid,
+            const coverage_summary & the_coverage,
+            const change_summary * the_changes, const int the_root_zoom,
+            const int the_end_zoom, const tile_output & the_output,
+            boost::mutex & the_progress_mutex)
+        : pyramid(the_pyramid), coverage(the_coverage),
+            changes(the_changes), root_zoom(the_root_zoom),
+            end_zoom(the_end_zoom), output(the_output),
+            progress_mutex(the_progress_mutex) { }
+
+    void operator()(const tile_t & tile, tile_pool_t::worker & w) const
+    {
+        using boost::tie;
+
+        long t_x, t_y;
+        int t_z;
+        tie(t_x, t_y, t_z) = tile;
+
+        if (t_z < root_zoom)
+        {
+            const char * status = "";
+            if (unchanged(changes, output, t_x, t_y, t_z))
+            {
+                output.keep(t_x, t_y, t_z);
+                status = " unchanged";
+            }
+            else if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+                output.put_empty(t_x, t_y, t_z);
+            else
+                output.render(pyramid, t_x, t_y, t_z);
+
+            boost::lock_guard<boost::mutex> lock(progress_mutex);
+            std::cout << output.name(t_x, t_y, t_z) << status << '\n'
+                << std::flush;
+        }
+        else if (!keep_unchanged_subtree(pyramid.base, changes, t_x, t_y,
+                    t_z, end_zoom, output, progress_mutex))
+        {
+            value_tile out;
+            render_downsampled_subtree(pyramid, coverage, t_x, t_y, t_z,
+                    end_zoom, output, out, progress_mutex);
+        }
+    }
+
+    const polar_pyramid & pyramid;
+    const coverage_summary & coverage;
+    const change_summary * changes;
+    const int root_zoom, end_zoom;
+    const tile_output & output;
+    boost::mutex & progress_mutex;
+};
+
+/*
+ * Render the tiles from start_zoom to end_zoom that intersect the site's
+ * coverage, sampling only the deepest zoom level from the cut and building
+ * each level above it by downsampling the radar values of its four children.
+ * Tiles at or above exact_zoom are still sampled directly from the cut, for
+ * the low zoom levels where the difference is visible. Pass an exact_zoom
+ * below start_zoom to downsample everything.
+ *
+ * The subtrees below the directly sampled levels are independent, so they are
+ * spread over a pool of threads. Given the changes since the previous volume,
+ * directly sampled tiles and whole subtrees they don't touch are kept from
+ * the previous volume instead.
+ */
+void
+generate_tiles_downsampled(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom, const int exact_zoom,
+        const size_t thread_count, const tile_output & output,
+        const change_summary * changes)
+{
+    const simple_cut & cut = pyramid.base;
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    const int root_zoom = std::max(exact_zoom + 1, start_zoom);
+
+    const coverage_summary coverage(cut);
+
+    std::auto_ptr< std::vector<tile_t> > tiles_p;
+    tiles_p = find_intersecting_tiles(tile_t(0, 0, 1), to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, std::min(root_zoom, end_zoom));
+
+    tile_pool_t pool(n);
+    boost::mutex progress_mutex;
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles_p->begin();
+            iter != tiles_p->end();
+            ++iter)
+        if (boost::get<2>(*iter) >= start_zoom)
+            pool.push(*iter);
+
+    pool.run(downsample_task(pyramid, coverage, changes, root_zoom,
+                end_zoom, output, progress_mutex));
+}
+
+/*
+ * Same as above, writing a file per tile under out/.
+ */
+void
+generate_tiles_downsampled(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom, const int exact_zoom,
+        const size_t thread_count, const tile_format output_format)
+{
+    const tile_output output(pyramid.base, output_format);
+    generate_tiles_downsampled(pyramid, start_zoom, end_zoom, exact_zoom,
+            thread_count, output);
+}
+
+/*
+ * The tiles of each metatile, keyed by the metatile's coordinates: the
+ * coordinates of its tiles divided by the metatile size, and its zoom level.
+ */
+typedef std::map< tile_t, std::vector<tile_t> > metatile_map_t;
+
+/*
+ * Renders the tiles of one metatile, one after another, on a pixel grid
+ * shared between them.
+ */
+struct metatile_task
+{
+    metatile_task(const polar_pyramid & the_pyramid,
+            const coverage_summary & the_coverage,
+            const change_summary * the_changes,
+            const metatile_map_t & the_metatiles, const int the_size,
+            const tile_output & the_output,
+            boost::mutex & the_progress_mutex)
+        : pyramid(the_pyramid), coverage(the_coverage),
+            changes(the_changes), metatiles(the_metatiles), size(the_size),
+            output(the_output), progress_mutex(the_progress_mutex) { }
+
+    void operator()(const tile_t & metatile, tile_pool_t::worker & w) const
+    {
+        using boost::tie;
+
+        long m_x, m_y;
+        int t_z;
+        tie(m_x, m_y, t_z) = metatile;
+
+        // At the lowest zoom levels the whole world is less than a metatile.
+        const long tiles_per_side = 1L << t_z;
+        const long first_x = m_x * size, first_y = m_y * size;
+        const boost::shared_ptr<const pixel_grid> grid(new pixel_grid(
+                    first_x, first_y, t_z,
+                    std::min<long>(size, tiles_per_side - first_x),
+                    std::min<long>(size, tiles_per_side - first_y)));
+
+        const std::vector<tile_t> & tiles =
+            metatiles.find(metatile)->second;
+        std::vector<tile_t>::const_iterator iter;
+        for (iter = tiles.begin();
+                iter != tiles.end();
+                ++iter)
+        {
+            const long t_x = boost::get<0>(*iter), t_y = boost::get<1>(*iter);
+            const char * status = "";
+
+            if (unchanged(changes, output, t_x, t_y, t_z))
+            {
+                output.keep(t_x, t_y, t_z);
+                status = " unchanged";
+            }
+            else if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            {
+                output.put_empty(t_x, t_y, t_z);
+                status = " empty (no echo)";
+            }
+            else
+                output.render(tile_sampler(pyramid, grid, t_x, t_y,
+                            output.sampling(t_z)));
+
+            boost::lock_guard<boost::mutex> lock(progress_mutex);
+            std::cout << output.name(t_x, t_y, t_z) << status << '\n'
+                << std::flush;
+        }
+    }
+
+    const polar_pyramid & pyramid;
+    const coverage_summary & coverage;
+    const change_summary * changes;
+    const metatile_map_t & metatiles;
+    const int size;
+    const tile_output & output;
+    boost::mutex & progress_mutex;
+};
+
+/*
+ * Render the tiles from start_zoom to end_zoom that intersect the site's
+ * coverage a metatile at a time: a block of metatile_size by metatile_size
+ * tiles of one zoom level, lined up on multiples of the size. The latitude
+ * and longitude of every row and column of pixels are worked out once for
+ * the block and shared by all its tiles, and each thread renders whole
+ * blocks, so neighbouring tiles are sampled together while the parts of the
+ * pyramid under them are still in cache. Every pixel is sampled exactly
+ * where, and with the same filter width, it would be tile by tile, so the
+ * tiles come out the same either way. Since the filter width follows the
+ * rows of pixels on the grid rather than stepping from one tile to the next,
+ * either way there is no seam where tiles meet. Tiles are otherwise handled
+ * as in generate_tiles_parallel(), without pruning.
+ */
+void
+generate_tiles_metatiled(const polar_pyramid & pyramid, const int start_zoom,
+        const int end_zoom, const int metatile_size,
+        const size_t thread_count, const tile_output & output,
+        const change_summary * changes)
+{
+    const simple_cut & cut = pyramid.base;
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    const coverage_summary coverage(cut);
+
+    std::auto_ptr< std::vector<tile_t> > tiles_p;
+    tiles_p = find_intersecting_tiles(tile_t(0, 0, 1), to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, end_zoom);
+
+    metatile_map_t metatiles;
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles_p->begin();
+            iter != tiles_p->end();
+            ++iter)
+        if (boost::get<2>(*iter) >= start_zoom)
+            metatiles[tile_t(boost::get<0>(*iter) / metatile_size,
+                    boost::get<1>(*iter) / metatile_size,
+                    boost::get<2>(*iter))].push_back(*iter);
+
+    tile_pool_t pool(n);
+    boost::mutex progress_mutex;
+
+    metatile_map_t::const_iterator m_iter;
+    for (m_iter = metatiles.begin();
+            m_iter != metatiles.end();
+            ++m_iter)
+        pool.push(m_iter->first);
+
+    pool.run(metatile_task(pyramid, coverage, changes, metatiles,
+                metatile_size, output, progress_mutex));
+}
+
+} // namespace tile_generator
@@ -0,0 +1,42 @@
+#ifndef RSME_INCLUDED_PARALLEL_GENERATE_HPP
+#define RSME_INCLUDED_PARALLEL_GENERATE_HPP
+
+#include <cstddef>
+
+#include "polar_pyramid.hpp"
+#include "single_site_tile.hpp"
+#include "tile_output.hpp"
+#include "coverage.hpp"
+
+namespace tile_generator {
+
+/*
+ * Tiles on a side of a metatile, when generating by metatiles.
+ */
+const int METATILE_DEFAULT_SIZE = 8;
+
+void generate_tiles_parallel(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom,
+        const bool prune_insignificant, const size_t thread_count,
+        const tile_output & output, const change_summary * changes = 0);
+void generate_tiles_downsampled(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom, const int exact_zoom,
+        const size_t thread_count, const tile_output & output,
+        const change_summary * changes = 0);
+void generate_tiles_metatiled(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom, const int metatile_size,
+        const size_t thread_count, const tile_output & output,
+        const change_summary * changes = 0);
+
+void generate_tiles_parallel(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom,
+        const bool prune_insignificant, const size_t thread_count,
+        const tile_format format = TILE_COLORIZED);
+void generate_tiles_downsampled(const polar_pyramid & pyramid,
+        const int start_zoom, const int end_zoom, const int exact_zoom,
+        const size_t thread_count,
+        const tile_format format = TILE_COLORIZED);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_PARALLEL_GENERATE_HPP
@@ -0,0 +1,433 @@
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ios>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <png.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/cstdint.hpp>
+#include <boost/gil/typedefs.hpp>
+#include <boost/gil/pixel.hpp>
+#include <boost/gil/image_view.hpp>
+#include <boost/gil/color_base_algorithm.hpp>
+
+#include "png_encoder.hpp"
+
+namespace tile_generator {
+
+namespace gil = boost::gil;
+
+typedef boost::uint32_t packed_pixel_t;
+
+/*
+ * Most entries a palette image can have, and the most low bits that will be
+ * dropped from each channel to get a tile's colors down to that many.
+ */
+const size_t MAX_PALETTE_ENTRIES = 256;
+const int MAX_DROPPED_BITS = 4;
+
+png_options::png_options()
+    : zlib_level(6), zlib_strategy(Z_DEFAULT_STRATEGY),
+        filters(PNG_ALL_FILTERS), use_palette(true) { }
+
+/*
+ * Pack a pixel as RGBA into a sortable word. Every fully transparent pixel
+ * looks the same as far as anyone viewing the tile can tell, so they all pack
+ * to zero.
+ */
+inline
+packed_pixel_t
+pack_pixel(const gil::rgba8_pixel_t & p)
+{
+    const packed_pixel_t a = gil::semantic_at_c<3>(p);
+    if (a == 0)
+        return 0;
+
+    return (packed_pixel_t(gil::semantic_at_c<0>(p)) << 24)
+        | (packed_pixel_t(gil::semantic_at_c<1>(p)) << 16)
+        | (packed_pixel_t(gil::semantic_at_c<2>(p)) << 8)
+        | a;
+}
+
+/*
+ * Drop the given number of low bits from each channel of a packed pixel.
+ * Opaque pixels stay opaque, and translucent ones stay visible.
+ */
+inline
+packed_pixel_t
+reduce_pixel(const packed_pixel_t p, const int dropped_bits)
+{
+    const packed_pixel_t m = 0xff & (0xff << dropped_bits);
+    const packed_pixel_t a = p & 0xff;
+
+    if (p == 0)
+        return 0;
+    else if (a == 0xff)
+        return (p & ((m << 24) | (m << 16) | (m << 8))) | a;
+    else
+        return (p & ((m << 24) | (m << 16) | (m << 8) | m))
+            | ((a & m) == 0 ? 1 : 0);
+}
+
+/*
+ * A tile converted to palette form. The palette is ordered with the
+ * translucent entries first, so the tRNS chunk only needs to cover those.
+ */
+struct indexed_image
+{
+    std::vector<png_color> palette;
+    std::vector<png_byte>  alpha;
+    std::vector<png_byte>  indices;
+};
+
+/*
+ * Convert a view to palette form. The tone mapped colors lie along a curve
+ * through the color table, so often there are few enough of them to index
+ * exactly. When there are too many, low bits are dropped from every channel
+ * until the buckets fit, and each palette entry is the mean of the pixels
+ * that fall in its bucket. Returns false if the colors can't be fit even
+ * then.
+ */
+bool
+quantize(const gil::rgba8c_view_t & view, indexed_image & out)
+{
+    const int width = view.width(), height = view.height();
+
+    std::vector<packed_pixel_t> pixels;
+    pixels.reserve(width * height);
+    for (int y = 0;
+            y != height;
+            ++y)
+    {
+        gil::rgba8c_view_t::x_iterator row = view.row_begin(y);
+        for (int x = 0;
+                x != width;
+                ++x)
+            pixels.push_back(pack_pixel(row[x]));
+    }
+
+    // Distinct colors, and how many pixels have each.
+    std::vector<packed_pixel_t> sorted(pixels);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<packed_pixel_t> colors;
+    std::vector<size_t> counts;
+    for (size_t i = 0;
+            i != sorted.size();
+            ++i)
+    {
+        if (colors.empty() || colors.back() != sorted[i])
+        {
+            colors.push_back(sorted[i]);
+            counts.push_back(0);
+        }
+        ++counts.back();
+    }
+
+    // The colors vary along the table in alpha as much as in color, so all
+    // the channels are reduced together.
+    std::vector<packed_pixel_t> keys;
+    int dropped_bits = 0;
+    for (;;)
+    {
+        keys.clear();
+        for (size_t i = 0;
+                i != colors.size();
+                ++i)
+            keys.push_back(reduce_pixel(colors[i], dropped_bits));
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        if (keys.size() <= MAX_PALETTE_ENTRIES)
+            break;
+        else if (dropped_bits < MAX_DROPPED_BITS)
+            ++dropped_bits;
+        else
+            return false;
+    }
+
+    // Palette slot for each key, translucent ones first.
+    std::vector<png_byte> slot(keys.size());
+    int next_slot = 0;
+    for (size_t k = 0;
+            k != keys.size();
+            ++k)
+        if ((keys[k] & 0xff) != 0xff)
+            slot[k] = next_slot++;
+    const int translucent_entries = next_slot;
+    for (size_t k = 0;
+            k != keys.size();
+            ++k)
+        if ((keys[k] & 0xff) == 0xff)
+            slot[k] = next_slot++;
+
+    // Each entry is the mean of the colors in its bucket, weighted by pixel
+    // count.
+    std::vector<size_t> sums(keys.size() * 4, 0), weights(keys.size(), 0);
+    for (size_t i = 0;
+            i != colors.size();
+            ++i)
+    {
+        const size_t k = std::lower_bound(keys.begin(), keys.end(),
+                reduce_pixel(colors[i], dropped_bits))
+            - keys.begin();
+        for (int c = 0;
+                c != 4;
+                ++c)
+            sums[k * 4 + c] +=
+                ((colors[i] >> (24 - 8 * c)) & 0xff) * counts[i];
+        weights[k] += counts[i];
+    }
+
+    out.palette.resize(keys.size());
+    out.alpha.resize(translucent_entries);
+    for (size_t k = 0;
+            k != keys.size();
+            ++k)
+    {
+        const size_t w = weights[k], half = weights[k] / 2;
+        png_color & entry = out.palette[slot[k]];
+        entry.red   = (sums[k * 4 + 0] + half) / w;
+        entry.green = (sums[k * 4 + 1] + half) / w;
+        entry.blue  = (sums[k * 4 + 2] + half) / w;
+        if (slot[k] < translucent_entries)
+            out.alpha[slot[k]] = (sums[k * 4 + 3] + half) / w;
+    }
+
+    // Neighboring pixels are usually the same color, so remember the last
+    // lookup.
+    out.indices.resize(pixels.size());
+    packed_pixel_t last_pixel = pixels.empty() ? 0 : pixels[0] + 1;
+    png_byte last_index = 0;
+    for (size_t i = 0;
+            i != pixels.size();
+            ++i)
+    {
+        if (pixels[i] != last_pixel)
+        {
+            last_pixel = pixels[i];
+            last_index = slot[std::lower_bound(keys.begin(), keys.end(),
+                    reduce_pixel(last_pixel, dropped_bits))
+                - keys.begin()];
+        }
+        out.indices[i] = last_index;
+    }
+
+    return true;
+}
+
+/*
+ * libpng output callbacks for encoding into a buffer.
+ */
+void
+append_to_buffer(png_structp png, png_bytep data, png_size_t length)
+{
+    std::vector<unsigned char> & out =
+        *static_cast<std::vector<unsigned char> *>(png_get_io_ptr(png));
+    out.insert(out.end(), data, data + length);
+}
+
+void
+flush_buffer(png_structp png) { }
+
+/*
+ * Run libpng over rows already laid out for the given color type, which is
+ * 8 bits per channel unless it's a palette image. The rows must be laid out
+ * before starting, so nothing that can throw happens while libpng's error
+ * handler is armed.
+ */
+void
+encode_rows(const std::vector<png_bytep> & rows, const int width,
+        const int color_type, const indexed_image * indexed,
+        std::vector<unsigned char> & out, const png_options & options)
+{
+    const int height = rows.size();
+
+    out.clear();
+    png_structp png =
+        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png == NULL)
+        throw png_encode_error("couldn't create write struct");
+    png_infop info = png_create_info_struct(png);
+    if (info == NULL)
+    {
+        png_destroy_write_struct(&png, NULL);
+        throw png_encode_error("couldn't create info struct");
+    }
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        throw png_encode_error("libpng error");
+    }
+
+    png_set_write_fn(png, &out, append_to_buffer, flush_buffer);
+    png_set_compression_level(png, options.zlib_level);
+    png_set_compression_strategy(png, options.zlib_strategy);
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+    {
+        const int entries = indexed->palette.size();
+        const int bit_depth =
+            (entries <= 2 ? 1 : entries <= 4 ? 2 : entries <= 16 ? 4 : 8);
+
+        png_set_IHDR(png, info, width, height, bit_depth,
+                PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_set_PLTE(png, info, &indexed->palette[0], entries);
+        if (!indexed->alpha.empty())
+            png_set_tRNS(png, info, &indexed->alpha[0],
+                    indexed->alpha.size(), NULL);
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+        png_write_info(png, info);
+        if (bit_depth < 8)
+            png_set_packing(png);
+    }
+    else
+    {
+        png_set_IHDR(png, info, width, height, 8, color_type,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, options.filters);
+        png_write_info(png, info);
+    }
+
+    png_write_image(png, const_cast<png_bytepp>(&rows[0]));
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+}
+
+/*
+ * Encode a view as a PNG into a buffer, replacing its contents.
+ */
+void
+encode_png(const gil::rgba8c_view_t & view, std::vector<unsigned char> & out,
+        const png_options & options)
+{
+    const int width = view.width(), height = view.height();
+
+    indexed_image indexed;
+    if (options.use_palette && quantize(view, indexed))
+    {
+        std::vector<png_bytep> rows(height);
+        for (int y = 0;
+                y != height;
+                ++y)
+            rows[y] = &indexed.indices[y * width];
+
+        encode_rows(rows, width, PNG_COLOR_TYPE_PALETTE, &indexed, out,
+                options);
+    }
+    else
+    {
+        std::vector<png_byte> truecolor(width * height * 4);
+        std::vector<png_bytep> rows(height);
+        for (int y = 0;
+                y != height;
+                ++y)
+        {
+            gil::rgba8c_view_t::x_iterator row = view.row_begin(y);
+            for (int x = 0;
+                    x != width;
+                    ++x)
+                for (int c = 0;
+                        c != 4;
+                        ++c)
+                    truecolor[(y * width + x) * 4 + c] = row[x][c];
+            rows[y] = &truecolor[y * width * 4];
+        }
+
+        encode_rows(rows, width, PNG_COLOR_TYPE_RGB_ALPHA, NULL, out,
+                options);
+    }
+}
+
+/*
+ * Encode interleaved 8-bit gray and alpha pixels as a PNG into a buffer,
+ * replacing its contents.
+ */
+void
+encode_gray_alpha_png(const std::vector<unsigned char> & pixels,
+        const int width, const int height, std::vector<unsigned char> & out,
+        const png_options & options)
+{
+    std::vector<png_bytep> rows(height);
+    for (int y = 0;
+            y != height;
+            ++y)
+        rows[y] = const_cast<png_bytep>(&pixels[y * width * 2]);
+
+    encode_rows(rows, width, PNG_COLOR_TYPE_GRAY_ALPHA, NULL, out, options);
+}
+
+void
+write_png(const gil::rgba8c_view_t & view, const char * filename,
+        const png_options & options)
+{
+    std::vector<unsigned char> png;
+    encode_png(view, png, options);
+    write_png_buffer(png, filename);
+}
+
+/*
+ * Write an encoded tile to a file. The tile goes to a temporary file beside
+ * it first, which is then renamed into place: the old file may be a hard
+ * link to the shared empty tile, which writing through would overwrite, and
+ * nothing reading the tiles ever sees one half written. The temporary file
+ * gets a name of its own from mkstemp(), since two writers of the same tile,
+ * like two gen-one runs asked for it at once, would otherwise truncate each
+ * other's. mkstemp() makes it readable only by its owner, so it is opened
+ * up to what the tiles have always been.
+ */
+void
+write_png_buffer(const std::vector<unsigned char> & png,
+        const char * filename)
+{
+    const std::string temp_template = std::string(filename) + ".XXXXXX";
+    std::vector<char> temp_name(temp_template.begin(), temp_template.end());
+    temp_name.push_back('\0');
+    const int fd = ::mkstemp(&temp_name[0]);
+    const std::string temp_path(&temp_name[0]);
+    if (fd < 0)
+        throw std::ios_base::failure(std::string("can't create temporary "
+                    "file for ") + filename + ": " + std::strerror(errno));
+
+    // A short write, as on a full disk, would otherwise leave a truncated
+    // tile that later runs take for a good one.
+    size_t done = 0;
+    bool ok = (::fchmod(fd, 0644) == 0);
+    while (ok && done != png.size())
+    {
+        const ssize_t n = ::write(fd, &png[done], png.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ok = (n > 0);
+        if (ok)
+            done += n;
+    }
+    int error = (ok ? 0 : errno);
+    if (::close(fd) != 0 && ok)
+    {
+        ok = false;
+        error = errno;
+    }
+    if (!ok)
+    {
+        ::unlink(temp_path.c_str());
+        throw std::ios_base::failure("can't write " + temp_path + ": "
+                + std::strerror(error));
+    }
+
+    if (std::rename(temp_path.c_str(), filename) != 0)
+    {
+        const std::string reason = std::strerror(errno);
+        ::unlink(temp_path.c_str());
+        throw std::ios_base::failure(std::string("can't rename ")
+                + temp_path + " to " + filename + ": " + reason);
+    }
+}
+
+} // namespace tile_generator
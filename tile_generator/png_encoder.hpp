@@ -0,0 +1,61 @@
+#ifndef RSME_INCLUDED_PNG_ENCODER_HPP
+#define RSME_INCLUDED_PNG_ENCODER_HPP
+
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/gil/typedefs.hpp>
+
+namespace tile_generator {
+
+namespace gil = boost::gil;
+
+/*
+ * Settings for encoding tiles. The zlib level runs from 0 (store) to 9, and
+ * the strategy is one of zlib's Z_* strategies. The filters are a mask of
+ * libpng's PNG_FILTER_* flags, and are only used for truecolor and gray
+ * output, since palette images compress best unfiltered.
+ *
+ * With use_palette set, the tile is written as an 8-bit (or smaller) palette
+ * image with a tRNS chunk whenever its colors can be fit into 256 entries,
+ * which for tone mapped radar data is nearly always.
+ */
+struct png_options
+{
+    png_options();
+
+    int  zlib_level;
+    int  zlib_strategy;
+    int  filters;
+    bool use_palette;
+};
+
+class png_encode_error
+  : public std::exception
+{
+public:
+    std::string message;
+
+    png_encode_error(const std::string & what)
+      : message("PNG encoding failed: " + what)
+    { }
+    ~png_encode_error() throw() { }
+
+    virtual const char * what(void) const throw()
+    { return message.c_str(); }
+};
+
+void encode_png(const gil::rgba8c_view_t & view,
+        std::vector<unsigned char> & out,
+        const png_options & options = png_options());
+void encode_gray_alpha_png(const std::vector<unsigned char> & pixels,
+        const int width, const int height, std::vector<unsigned char> & out,
+        const png_options & options = png_options());
+void write_png(const gil::rgba8c_view_t & view, const char * filename,
+        const png_options & options = png_options());
+void write_png_buffer(const std::vector<unsigned char> & png,
+        const char * filename);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_PNG_ENCODER_HPP
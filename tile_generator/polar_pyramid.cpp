@@ -0,0 +1,300 @@
+#include <vector>
+#include <utility>
+#include <cmath>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "polar_pyramid.hpp"
+#include "sample_cut.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+/*
+ * Set up a decimated radial with the same geometry as the one given.
+ */
+template <typename Radial>
+decimated_radial
+empty_like(const Radial & rad)
+{
+    decimated_radial out;
+    out.azimuth            = rad.azimuth;
+    out.elevation          = rad.elevation;
+    out.start_range_meters = rad.start_range_meters;
+    out.range_res_meters   = rad.range_res_meters;
+    return out;
+}
+
+/*
+ * Halve the range resolution of a radial. Each output gate is the mean of the
+ * two input gates it covers, taken as interpreted values. The output gate sits
+ * halfway between the two, which moves the start range out by half a gate.
+ */
+template <typename Radial>
+decimated_radial
+decimate_range(const Radial & rad)
+{
+    decimated_radial out = empty_like(rad);
+    out.start_range_meters += rad.range_res_meters / 2.0;
+    out.range_res_meters *= 2.0;
+
+    out.gates.resize((rad.gates.size() + 1) / 2);
+    for (int j = 0;
+            j != static_cast<int>(out.gates.size());
+            ++j)
+    {
+        const radar_value_t a = gate_val(rad, 2 * j);
+        const radar_value_t b = gate_val(rad, 2 * j + 1);
+        out.gates[j] = radar_value_t((a.first + b.first) / 2.0,
+                (a.second + b.second) / 2.0);
+    }
+
+    return out;
+}
+
+/*
+ * Merge two radials adjacent in azimuth into one, gate by gate.
+ */
+decimated_radial
+merge_azimuth(const decimated_radial & a, const decimated_radial & b)
+{
+    decimated_radial out = empty_like(a);
+    out.azimuth   = (a.azimuth + b.azimuth) / 2.0;
+    out.elevation = (a.elevation + b.elevation) / 2.0;
+
+    out.gates.resize(std::max(a.gates.size(), b.gates.size()));
+    for (int k = 0;
+            k != static_cast<int>(out.gates.size());
+            ++k)
+    {
+        const radar_value_t rv_a = gate_val(a, k);
+        const radar_value_t rv_b = gate_val(b, k);
+        out.gates[k] = radar_value_t((rv_a.first + rv_b.first) / 2.0,
+                (rv_a.second + rv_b.second) / 2.0);
+    }
+
+    return out;
+}
+
+/*
+ * Build the next range level up from a set of radials.
+ */
+template <typename RadialMap>
+void
+decimate_range(const RadialMap & radials, decimated_cut & out)
+{
+    typename RadialMap::const_iterator iter;
+    for (iter = radials.begin();
+            iter != radials.end();
+            ++iter)
+        out.radials.insert(
+                std::make_pair(iter->first, decimate_range(iter->second)));
+}
+
+/*
+ * Build the next azimuth level up by merging radials pairwise in azimuth
+ * order. An odd radial left over at the end is carried up unmerged.
+ */
+void
+decimate_azimuth(const decimated_cut::radials_type & radials,
+        decimated_cut & out)
+{
+    decimated_cut::radials_type::const_iterator iter = radials.begin();
+    while (iter != radials.end())
+    {
+        decimated_cut::radials_type::const_iterator first = iter;
+        ++iter;
+        if (iter == radials.end())
+        {
+            out.radials.insert(*first);
+            break;
+        }
+
+        const decimated_radial merged =
+            merge_azimuth(first->second, iter->second);
+        out.radials.insert(std::make_pair(merged.azimuth, merged));
+        ++iter;
+    }
+}
+
+/*
+ * Find the runs of gates with data along a radial.
+ */
+template <typename Radial>
+data_runs_t
+find_data_runs(const Radial & rad)
+{
+    data_runs_t runs;
+    const int count = static_cast<int>(rad.gates.size());
+    int k = 0;
+    while (k != count)
+    {
+        while (k != count && gate_val(rad, k) == radar_value_t(0.0, 0.0))
+            ++k;
+        if (k == count)
+            break;
+
+        data_run run;
+        run.start = k;
+        while (k != count && gate_val(rad, k) != radar_value_t(0.0, 0.0))
+            ++k;
+        run.stop = k;
+        runs.push_back(run);
+    }
+
+    return runs;
+}
+
+template <typename RadialMap>
+void
+find_data_runs(const RadialMap & radials, std::vector<data_runs_t> & out)
+{
+    out.clear();
+    out.reserve(radials.size());
+
+    typename RadialMap::const_iterator iter;
+    for (iter = radials.begin();
+            iter != radials.end();
+            ++iter)
+        out.push_back(find_data_runs(iter->second));
+}
+
+/*
+ * Put a radial's gates into fixed point, rounding to the nearest step.
+ */
+template <typename Radial>
+fixed_radial
+make_fixed_radial(const Radial & rad)
+{
+    fixed_radial out;
+    const int count = static_cast<int>(rad.gates.size());
+    out.z.reserve(count + 1);
+    out.v.reserve(count + 1);
+    for (int k = 0;
+            k != count + 1;
+            ++k)
+    {
+        const radar_value_t rv = gate_val(rad, k);
+        out.z.push_back(static_cast<short>(
+                    std::floor(rv.first * FIXED_Z_ONE + 0.5f)));
+        out.v.push_back(static_cast<short>(
+                    std::floor(rv.second * FIXED_V_ONE + 0.5f)));
+    }
+
+    return out;
+}
+
+template <typename RadialMap>
+void
+make_fixed_radials(const RadialMap & radials, std::vector<fixed_radial> & out)
+{
+    out.clear();
+    out.reserve(radials.size());
+
+    typename RadialMap::const_iterator iter;
+    for (iter = radials.begin();
+            iter != radials.end();
+            ++iter)
+        out.push_back(make_fixed_radial(iter->second));
+}
+
+polar_pyramid::polar_pyramid(const simple_cut & the_cut,
+        const int max_range_levels)
+    : base(the_cut), beam(the_cut), base_angular_res_deg(0.0),
+        base_range_res_meters(0.0), range_levels(0), fixed_once()
+{
+    if (base.radials.empty())
+        return;
+
+    find_data_runs(base.radials, base_data_runs);
+    base_angular_res_deg = 360.0 / base.radials.size();
+    base_range_res_meters = base.radials.begin()->second.range_res_meters;
+    range_levels = max_range_levels;
+
+    // The references into levels taken below rely on this never reallocating.
+    levels.resize(range_levels * (range_levels + 3) / 2);
+
+    for (int r = 1;
+            r <= range_levels;
+            ++r)
+    {
+        decimated_cut & range_dc = levels[level_offset(r, 0)];
+        range_dc.angular_res_deg = base_angular_res_deg;
+        range_dc.range_res_meters = base_range_res_meters * (1 << r);
+        if (r == 1)
+            decimate_range(base.radials, range_dc);
+        else
+            decimate_range(level(r - 1, 0).radials, range_dc);
+        find_data_runs(range_dc.radials, range_dc.data_runs);
+
+        for (int a = 1;
+                a <= r;
+                ++a)
+        {
+            decimated_cut & az_dc = levels[level_offset(r, a)];
+            az_dc.angular_res_deg = base_angular_res_deg * (1 << a);
+            az_dc.range_res_meters = range_dc.range_res_meters;
+            decimate_azimuth(level(r, a - 1).radials, az_dc);
+            find_data_runs(az_dc.radials, az_dc.data_runs);
+        }
+    }
+}
+
+/*
+ * Select the coarsest level whose gate spacing and radial spacing both fit
+ * inside the filter kernel, so the kernel still spans at least one sample per
+ * unit of filter scale in each direction.
+ */
+std::pair<int, int>
+polar_pyramid::select_level(const float range_filter_width_meters,
+        const float az_filter_scale_deg) const
+{
+    int r = 0, a = 0;
+    while (r != range_levels
+            && base_range_res_meters * (2 << r) <= range_filter_width_meters)
+        ++r;
+    while (a != r
+            && base_angular_res_deg * (2 << a) <= az_filter_scale_deg)
+        ++a;
+
+    return std::make_pair(r, a);
+}
+
+const decimated_cut &
+polar_pyramid::level(const int range_level, const int az_level) const
+{
+    return levels[level_offset(range_level, az_level)];
+}
+
+/*
+ * The gates of a level in fixed point, (0, 0) being the cut. The first call
+ * from any thread puts every level into fixed point at once.
+ */
+const std::vector<fixed_radial> &
+polar_pyramid::fixed(const int range_level, const int az_level) const
+{
+    boost::call_once(fixed_once,
+            boost::bind(&polar_pyramid::make_fixed, this));
+    return fixed_levels[range_level == 0
+        ? 0
+        : level_offset(range_level, az_level) + 1];
+}
+
+void
+polar_pyramid::make_fixed(void) const
+{
+    fixed_levels.resize(levels.size() + 1);
+    make_fixed_radials(base.radials, fixed_levels[0]);
+    for (size_t i = 0;
+            i != levels.size();
+            ++i)
+        make_fixed_radials(levels[i].radials, fixed_levels[i + 1]);
+}
+
+size_t
+polar_pyramid::level_offset(const int range_level, const int az_level)
+{
+    return range_level * (range_level + 1) / 2 + az_level - 1;
+}
+
+} // namespace tile_generator
@@ -0,0 +1,142 @@
+#ifndef RSME_INCLUDED_POLAR_PYRAMID_HPP
+#define RSME_INCLUDED_POLAR_PYRAMID_HPP
+
+#include <vector>
+#include <utility>
+#include <boost/thread/once.hpp>
+
+#include "sample_cut.hpp"
+#include "beam_geometry.hpp"
+#include "../base_extract/simple_cut.hpp"
+#include "../base_extract/indexed_map.hpp"
+
+namespace tile_generator {
+
+using base_extract::simple_cut;
+using base_extract::indexed_map;
+using base_extract::azimuth_indexer;
+
+/*
+ * Number of range levels built by default. Each range level halves the
+ * resolution in range, so with 250 meter base data the coarsest level has 8
+ * kilometer gates.
+ */
+const int POLAR_PYRAMID_DEFAULT_LEVELS = 5;
+
+/*
+ * A radial from a decimated pyramid level. Unlike simple_radial, the gates
+ * hold already-interpreted radar values, since averaging gates with differing
+ * validity can produce partially valid values that cannot be represented in
+ * the raw gate encoding.
+ */
+struct decimated_radial
+{
+    float azimuth;
+    float elevation;
+    float start_range_meters;
+    float range_res_meters;
+
+    std::vector<radar_value_t> gates;
+};
+
+/*
+ * One level of the pyramid. This carries only what the sampler needs out of a
+ * cut, plus the resolution of the level and the runs of data along each
+ * radial, in the same order as the radials.
+ */
+struct decimated_cut
+{
+    decimated_cut() : radials(azimuth_indexer()) { }
+
+    float angular_res_deg;
+    float range_res_meters;
+
+    typedef indexed_map<float, decimated_radial, azimuth_indexer>
+        radials_type;
+    radials_type radials;
+    std::vector<data_runs_t> data_runs;
+};
+
+/*
+ * Polar level-of-detail pyramid over a cut. Level (0, 0) is the cut itself.
+ * Going up one range level halves the resolution in range by averaging pairs
+ * of adjacent gates, and going up one azimuth level halves the resolution in
+ * azimuth by averaging pairs of adjacent radials. Either way this is exactly
+ * a box filter over the level below.
+ *
+ * The two directions are decimated separately because the kernel is almost
+ * never square: at low zoom the range kernel is many gates wide everywhere,
+ * but the azimuth kernel only gets wide near the site. The azimuth kernel is
+ * never wider than the range kernel except within a few hundred meters of the
+ * site, so only levels with no more azimuth than range decimation are built,
+ * which keeps the levels to about 1.5 times as many gates as the cut. Their
+ * gates are radar_value_t pairs, though, 8 bytes to the cut's 1, so in
+ * memory the levels come to about 12 times the cut's gates: 16 MB for a cut
+ * of 720 radials of 1832 gates. That is what site_cache holds per site, and
+ * what gen-one builds for every tile it renders.
+ *
+ * The sampler picks the coarsest level whose resolution is still no coarser
+ * than the filter kernel, so the number of taps per kernel stays roughly
+ * constant no matter how wide the filter gets at low zoom levels. It finds
+ * the gate under a point through the cut's beam geometry, which all the
+ * levels share, and skips the stretches of every level without data. Every
+ * level, the cut included, can also give its gates in fixed point for the
+ * integer kernel. Only +fixed policies use those, so they are built the
+ * first time any are asked for rather than with the pyramid.
+ */
+struct polar_pyramid
+{
+    polar_pyramid(const simple_cut & the_cut,
+            const int range_levels = POLAR_PYRAMID_DEFAULT_LEVELS);
+
+    // Returns (range_level, azimuth_level).
+    std::pair<int, int> select_level(const float range_filter_width_meters,
+            const float az_filter_scale_deg) const;
+    const decimated_cut & level(const int range_level,
+            const int az_level) const;
+    const std::vector<fixed_radial> & fixed(const int range_level,
+            const int az_level) const;
+
+    const simple_cut & base;
+    std::vector<data_runs_t> base_data_runs;
+    beam_geometry beam;
+    float base_angular_res_deg;
+    float base_range_res_meters;
+    int range_levels;
+
+private:
+    static size_t level_offset(const int range_level, const int az_level);
+    void make_fixed(void) const;
+
+    // Triangular array of levels, not including (0, 0), in the order (1, 0),
+    // (1, 1), (2, 0), (2, 1), (2, 2), (3, 0), ...
+    std::vector<decimated_cut> levels;
+
+    // Fixed point gates of the cut, then of the levels in the same order.
+    mutable boost::once_flag fixed_once;
+    mutable std::vector< std::vector<fixed_radial> > fixed_levels;
+};
+
+/*
+ * Get the value of a gate from a decimated radial, with the same edge
+ * semantics as gate_val() on a simple_radial: gates off either end of the
+ * radial take the measurement of the end gate but are invalid. A radial
+ * with no gates at all has no data anywhere.
+ */
+inline
+radar_value_t
+gate_val(const decimated_radial & rad, int gate_idx)
+{
+    if (rad.gates.empty())
+        return radar_value_t(0.0, 0.0);
+    else if (gate_idx < 0)
+        return radar_value_t(rad.gates.front().first, 0.0);
+    else if (gate_idx > static_cast<int>(rad.gates.size()) - 1)
+        return radar_value_t(rad.gates.back().first, 0.0);
+    else
+        return rad.gates[gate_idx];
+}
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_POLAR_PYRAMID_HPP
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <boost/format.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "progressive_render.hpp"
+#include "work_stealing_pool.hpp"
+#include "polar_pyramid.hpp"
+#include "coverage.hpp"
+#include "geo_math.hpp"
+
+namespace tile_generator {
+
+progressive_renderer::progressive_renderer(const simple_cut & header,
+        const int start_zoom, const int end_zoom, const size_t thread_count,
+        const tile_output & the_output, const float the_step_deg)
+    : threads(thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency()),
+        output(the_output), step_deg(the_step_deg), first_azimuth(0.0),
+        last_azimuth(0.0), radial_count(0), slot_count(0),
+        angular_res_deg(0.0), rendered_through_deg(0.0), early(0), late(0)
+{
+    cut.radar_identifier = header.radar_identifier;
+    cut.latitude = header.latitude;
+    cut.longitude = header.longitude;
+    cut.geo_elevation = header.geo_elevation;
+    cut.vcp_nr = header.vcp_nr;
+    cut.start_timestamp = header.start_timestamp;
+    cut.end_timestamp = header.end_timestamp;
+
+    std::auto_ptr< std::vector<tile_t> > tiles =
+        find_intersecting_tiles(tile_t(0, 0, 1), to_rad(cut.latitude),
+                to_rad(cut.longitude), 300000.0, end_zoom);
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles->begin();
+            iter != tiles->end();
+            ++iter)
+        if (boost::get<2>(*iter) >= start_zoom)
+            pending.push_back(*iter);
+
+    simple_cut::radials_type::const_iterator rad_iter;
+    for (rad_iter = header.radials.begin();
+            rad_iter != header.radials.end();
+            ++rad_iter)
+        push(rad_iter->second);
+}
+
+/*
+ * Add the next radial of the sweep, and render whatever it completes. The
+ * spacing of the first two radials sets the number of radials a full sweep
+ * has, and so where each of the ones still to come will be.
+ */
+void
+progressive_renderer::push(const simple_radial & rad)
+{
+    cut.push(rad);
+
+    if (radial_count == 0)
+    {
+        first_azimuth = rad.azimuth;
+        stand_in = rad;
+        std::fill(stand_in.gates.begin(), stand_in.gates.end(), 0);
+    }
+    else if (radial_count == 1)
+    {
+        const float spacing = clockwise_deg(first_azimuth, rad.azimuth);
+        if (spacing >= 0.1 && spacing <= 45.0)
+        {
+            slot_count = size_t(360.0 / spacing + 0.5);
+            angular_res_deg = 360.0 / slot_count;
+            slot_filled.assign(slot_count, false);
+            slot_filled[0] = true;
+        }
+    }
+
+    if (slot_count > 0)
+        slot_filled[slot(rad.azimuth)] = true;
+
+    last_azimuth = rad.azimuth;
+    ++radial_count;
+
+    // Once the sweep is complete, the rest is left to finish().
+    const float swept = (slot_count > 0 ? swept_deg() : 0.0);
+    if (swept < 360.0 && swept - rendered_through_deg >= step_deg)
+        render_ready();
+}
+
+/*
+ * Render the tiles left over, from the complete cut.
+ */
+void
+progressive_renderer::finish(void)
+{
+    render_tiles(cut, pending);
+    late += pending.size();
+    pending.clear();
+}
+
+/*
+ * Render every pending tile whose footprint, widened by the azimuth kernel
+ * and a couple of radials for the pyramid's merging, lies inside the sector
+ * swept so far.
+ */
+void
+progressive_renderer::render_ready(void)
+{
+    const float swept = swept_deg();
+
+    simple_cut snapshot(cut);
+    for (size_t i = 0;
+            i != slot_count;
+            ++i)
+        if (!slot_filled[i])
+        {
+            stand_in.azimuth = std::fmod(first_azimuth
+                    + i * angular_res_deg, 360.0f);
+            snapshot.push(stand_in);
+        }
+
+    const float sector_start = first_azimuth - angular_res_deg / 2.0;
+    std::vector<tile_t> ready, still_pending;
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = pending.begin();
+            iter != pending.end();
+            ++iter)
+    {
+        const tile_footprint fp(snapshot, angular_res_deg,
+                boost::get<0>(*iter), boost::get<1>(*iter),
+                boost::get<2>(*iter));
+        const float margin = fp.az_filter_scale + 2.0 * angular_res_deg;
+        const float extent = fp.az_extent + 2.0 * margin;
+
+        if (!fp.all_azimuths && extent < 360.0
+                && clockwise_deg(sector_start, fp.az_start - margin)
+                    + extent <= swept)
+            ready.push_back(*iter);
+        else
+            still_pending.push_back(*iter);
+    }
+
+    std::cout << boost::format("%1$.1f degrees swept, %2% tiles ready\n")
+        % swept % ready.size() << std::flush;
+
+    if (!ready.empty())
+        render_tiles(snapshot, ready);
+
+    early += ready.size();
+    pending.swap(still_pending);
+    rendered_through_deg = swept;
+}
+
+typedef work_stealing_pool<tile_t> progressive_pool_t;
+
+/*
+ * Renders one tile, or puts it as the shared empty tile if the cut has no
+ * echo on it.
+ */
+struct progressive_task
+{
+    progressive_task(const polar_pyramid & the_pyramid,
+            const coverage_summary & the_coverage,
+            const tile_output & the_output, boost::mutex & the_progress_mutex)
+        : pyramid(the_pyramid), coverage(the_coverage), output(the_output),
+            progress_mutex(the_progress_mutex) { }
+
+    void operator()(const tile_t & tile, progressive_pool_t::worker &) const
+    {
+        using boost::tie;
+
+        long t_x, t_y;
+        int t_z;
+        tie(t_x, t_y, t_z) = tile;
+        const char * status = "";
+
+        if (coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+        {
+            output.put_empty(t_x, t_y, t_z);
+            status = " empty (no echo)";
+        }
+        else
+            output.render(pyramid, t_x, t_y, t_z);
+
+        const std::string name = output.name(t_x, t_y, t_z);
+        boost::lock_guard<boost::mutex> lock(progress_mutex);
+        std::cout << name << status << '\n' << std::flush;
+    }
+
+    const polar_pyramid & pyramid;
+    const coverage_summary & coverage;
+    const tile_output & output;
+    boost::mutex & progress_mutex;
+};
+
+void
+progressive_renderer::render_tiles(const simple_cut & render_cut,
+        const std::vector<tile_t> & tiles)
+{
+    if (tiles.empty())
+        return;
+
+    const polar_pyramid pyramid(render_cut);
+    const coverage_summary coverage(render_cut);
+
+    progressive_pool_t pool(threads);
+    boost::mutex progress_mutex;
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+        pool.push(*iter);
+    pool.run(progressive_task(pyramid, coverage, output, progress_mutex));
+}
+
+/*
+ * Which place in the sweep a radial takes, counting from the first.
+ */
+size_t
+progressive_renderer::slot(const float azimuth) const
+{
+    return size_t(clockwise_deg(first_azimuth, azimuth) / angular_res_deg
+            + 0.5) % slot_count;
+}
+
+/*
+ * How much of the sweep is in, in degrees, counting half a radial either
+ * side of the first and last.
+ */
+float
+progressive_renderer::swept_deg(void) const
+{
+    if (radial_count >= slot_count)
+        return 360.0;
+    return std::min(360.0f, clockwise_deg(first_azimuth, last_azimuth)
+            + angular_res_deg);
+}
+
+} // namespace tile_generator
@@ -0,0 +1,87 @@
+#ifndef RSME_INCLUDED_PROGRESSIVE_RENDER_HPP
+#define RSME_INCLUDED_PROGRESSIVE_RENDER_HPP
+
+#include <cstddef>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "bounds_test.hpp"
+#include "tile_output.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+using base_extract::simple_cut;
+using base_extract::simple_radial;
+
+/*
+ * How much more of the sweep has to be in before the next batch of tiles is
+ * rendered, in degrees. Each batch rebuilds the pyramid, so this trades the
+ * delay before a tile appears against the time spent rebuilding.
+ */
+const float PROGRESSIVE_STEP_DEG = 30.0;
+
+/*
+ * Renders the tiles of a cut while its radials are still coming in, so
+ * tiles appear while the antenna is still going round rather than only once
+ * the whole cut is in.
+ *
+ * Radials are pushed in the order they were taken. Every time another step
+ * of the sweep is complete, every tile whose footprint (see tile_footprint)
+ * lies entirely inside the part swept so far is rendered. The rest are
+ * rendered by finish(), from the complete cut.
+ *
+ * Tiles are rendered from a pyramid over the radials so far, with empty
+ * radials standing in for the ones still to come. The pyramid merges
+ * radials by their place in the sweep, so with the stand-ins in place it
+ * merges the same radials it will once the cut is complete, and a tile
+ * rendered early comes out exactly as it would from the complete cut. That
+ * holds as long as the sweep has the regular number of radials implied by
+ * the spacing of the first two, as a normal sweep does.
+ */
+class progressive_renderer : boost::noncopyable
+{
+public:
+    // The cut gives the site and volume. Any radials it already has are
+    // pushed first.
+    progressive_renderer(const simple_cut & header, const int start_zoom,
+            const int end_zoom, const size_t thread_count,
+            const tile_output & the_output,
+            const float the_step_deg = PROGRESSIVE_STEP_DEG);
+
+    void push(const simple_radial & rad);
+    void finish(void);
+
+    // Tiles rendered before the cut was complete, and after.
+    size_t early_count(void) const { return early; }
+    size_t late_count(void) const { return late; }
+
+    const simple_cut & current_cut(void) const { return cut; }
+
+private:
+    void render_ready(void);
+    void render_tiles(const simple_cut & render_cut,
+            const std::vector<tile_t> & tiles);
+    size_t slot(const float azimuth) const;
+    float swept_deg(void) const;
+
+    const size_t threads;
+    const tile_output & output;
+    const float step_deg;
+
+    simple_cut cut;
+    float first_azimuth, last_azimuth;
+    size_t radial_count;
+    size_t slot_count;
+    float angular_res_deg;
+    std::vector<bool> slot_filled;
+    simple_radial stand_in;
+    float rendered_through_deg;
+
+    std::vector<tile_t> pending;
+    size_t early, late;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_PROGRESSIVE_RENDER_HPP
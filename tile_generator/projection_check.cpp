@@ -0,0 +1,217 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <boost/format.hpp>
+#include <boost/tuple/tuple.hpp>
+
+#include "local_projection.hpp"
+#include "bounds_test.hpp"
+#include "tile_coord.hpp"
+#include "geo_math.hpp"
+
+using namespace tile_generator;
+
+/*
+ * Largest errors seen so far.
+ */
+struct projection_errors
+{
+    projection_errors() : range(0.0), bearing(0.0), cross_range(0.0),
+        points(0), far_angle(0.0), far_points(0), impossible(0) { }
+
+    double range;           // Meters
+    double bearing;         // Degrees
+    double cross_range;     // Meters
+    long points;
+
+    // Beyond the coverage radius only the central angle matters, to tell
+    // the point is out of range; and it had better be an angle at all.
+    double far_angle;       // Radians
+    long far_points;
+    long impossible;
+};
+
+/*
+ * Bearing from one lat/lon to another, all in radians, in double precision
+ * throughout, unlike initial_bearing_deg().
+ */
+double
+exact_bearing(const double lat_a, const double lon_a, const double lat_b,
+        const double lon_b)
+{
+    const double delta_lon = lon_b - lon_a;
+    return std::atan2(std::sin(delta_lon) * std::cos(lat_b),
+            std::cos(lat_a) * std::sin(lat_b)
+            - std::sin(lat_a) * std::cos(lat_b) * std::cos(delta_lon));
+}
+
+/*
+ * Compare one point against the exact bearing and central angle. Points
+ * closer than 1 km aren't counted, and those further than the coverage
+ * radius are only checked for their central angle, which has to be between
+ * 0 and pi however far round the earth they are.
+ */
+void
+check_point(const double site_lat, const double site_lon, const double lat,
+        const double lon, const polar_point & fast, projection_errors & e)
+{
+    const double angle = central_angle(site_lat, site_lon, lat, lon);
+    const double range = angle * MEAN_EARTH_RADIUS;
+    if (range < 1000.0)
+        return;
+    if (range > 300000.0)
+    {
+        if (!(fast.angular_distance >= 0.0 && fast.angular_distance <= PI))
+            ++e.impossible;
+        else
+            e.far_angle = std::max(e.far_angle,
+                    std::fabs(fast.angular_distance - angle));
+        ++e.far_points;
+        return;
+    }
+
+    double bearing_error = std::fabs(fast.theta_deg
+            - to_deg(exact_bearing(site_lat, site_lon, lat, lon)));
+    bearing_error = std::fmod(bearing_error, 360.0);
+    if (bearing_error > 180.0)
+        bearing_error = 360.0 - bearing_error;
+
+    const double range_error =
+        std::fabs(fast.angular_distance - angle) * MEAN_EARTH_RADIUS;
+    const double cross_range_error = to_rad(bearing_error) * range;
+
+    e.range = std::max(e.range, range_error);
+    e.bearing = std::max(e.bearing, bearing_error);
+    e.cross_range = std::max(e.cross_range, cross_range_error);
+    ++e.points;
+}
+
+/*
+ * Random points around a site, one at a time.
+ */
+void
+check_points(const double site_lat, const double site_lon, const int count,
+        projection_errors & e)
+{
+    const local_projection projection(site_lat, site_lon);
+
+    for (int k = 0;
+            k != count;
+            ++k)
+    {
+        // Destination from the site at a random bearing and distance.
+        const double bearing = 2.0 * PI * std::rand() / RAND_MAX;
+        const double angle = (1000.0 + 299000.0 * std::rand() / RAND_MAX)
+            / MEAN_EARTH_RADIUS;
+        const double lat = std::asin(std::sin(site_lat) * std::cos(angle)
+                + std::cos(site_lat) * std::sin(angle) * std::cos(bearing));
+        const double lon = site_lon + std::atan2(
+                std::sin(bearing) * std::sin(angle) * std::cos(site_lat),
+                std::cos(angle) - std::sin(site_lat) * std::sin(lat));
+
+        check_point(site_lat, site_lon, lat, lon,
+                projection.project(lat, lon), e);
+    }
+}
+
+/*
+ * Every pixel of every tile of a site's coverage at one zoom level. At low
+ * zoom levels the tiles reach far past the coverage radius, all the way
+ * round the earth at zoom 0.
+ */
+void
+check_tiles(const double site_lat, const double site_lon, const int t_z,
+        projection_errors & e)
+{
+    using boost::get;
+    using boost::tie;
+
+    const local_projection projection(site_lat, site_lon);
+    std::vector<tile_t> tiles;
+    find_intersecting_tiles(0, 0, 0, site_lat, site_lon, 300000.0, t_z,
+            tiles);
+
+    projected_tile centers;
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+    {
+        if (get<2>(*iter) != t_z)
+            continue;
+
+        long t_x, t_y;
+        int z;
+        tie(t_x, t_y, z) = *iter;
+        projection.project_tile(t_x, t_y, t_z, centers);
+
+        for (int y = 0;
+                y != TILE_DIMENSION_PIXELS;
+                ++y)
+            for (int x = 0;
+                    x != TILE_DIMENSION_PIXELS;
+                    ++x)
+            {
+                double lat, lon;
+                tie(lat, lon) = pixel_mercator_to_latlon(t_x, t_y, x + 0.5,
+                        y + 0.5, t_z);
+
+                const int i = y * TILE_DIMENSION_PIXELS + x;
+                polar_point fast;
+                fast.theta_deg = centers.theta_deg[i];
+                fast.angular_distance = centers.angular_distance[i];
+                check_point(site_lat, site_lon, lat, lon, fast, e);
+            }
+    }
+}
+
+/*
+ * Checks local_projection against the exact bearing and central angle over
+ * the coverage area of sites from 60 degrees south to 60 degrees north, and
+ * over the whole of the tiles at zoom levels 0 to 4 that take it in, and
+ * fails if any error is over the documented bound.
+ */
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using boost::format;
+    cout.sync_with_stdio(false);
+
+    std::srand(1);
+
+    projection_errors e;
+    for (int lat_deg = -60;
+            lat_deg <= 60;
+            lat_deg += 10)
+    {
+        const double site_lat = to_rad(lat_deg + 0.37);
+        const double site_lon = to_rad(-86.28 + 1.5 * lat_deg);
+        check_points(site_lat, site_lon, 200000, e);
+        for (int t_z = 0;
+                t_z <= 4;
+                ++t_z)
+            check_tiles(site_lat, site_lon, t_z, e);
+        check_tiles(site_lat, site_lon, 7, e);
+    }
+
+    cout << format("%1% points: range error %2$.3f m, bearing error "
+            "%3$.6f degrees (%4$.3f m across)\n")
+        % e.points % e.range % e.bearing % e.cross_range;
+    cout << format("%1% points beyond the coverage radius: central angle "
+            "error %2$.2e radians, %3% impossible\n")
+        % e.far_points % e.far_angle % e.impossible;
+
+    if (e.range > LOCAL_PROJECTION_MAX_RANGE_ERROR_METERS
+            || e.bearing > LOCAL_PROJECTION_MAX_BEARING_ERROR_DEG
+            || e.cross_range > LOCAL_PROJECTION_MAX_CROSS_RANGE_ERROR_METERS
+            || e.far_angle > LOCAL_PROJECTION_MAX_FAR_ANGLE_ERROR_RAD
+            || e.impossible != 0)
+    {
+        cout << "over the documented bound" << std::endl;
+        return 1;
+    }
+
+    cout << "within the documented bound" << std::endl;
+    return 0;
+}
@@ -0,0 +1,284 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
+#include "coverage.hpp"
+#include "bounds_test.hpp"
+#include "sampling_policy.hpp"
+#include "cpu_dispatch.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+using namespace tile_generator;
+
+/*
+ * A hardware event counter for this process and the threads it starts, by
+ * way of perf_event_open(2). Where the kernel or the machine doesn't offer
+ * the event, as in most virtual machines, the counter is unavailable.
+ */
+class event_counter : boost::noncopyable
+{
+public:
+    event_counter(const unsigned int type, const unsigned long long config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~event_counter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool available(void) const { return fd >= 0; }
+
+    void start(void)
+    {
+        if (fd < 0)
+            return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    long long stop(void)
+    {
+        long long count = -1;
+        if (fd < 0)
+            return count;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+        return count;
+    }
+
+private:
+    int fd;
+};
+
+/*
+ * One pass over the tiles in one order.
+ */
+struct bench_result
+{
+    bench_result() : seconds(-1.0), cache_references(-1),
+        cache_misses(-1), l1d_read_misses(-1) { }
+
+    double seconds;
+    long long cache_references;
+    long long cache_misses;
+    long long l1d_read_misses;
+};
+
+bench_result
+render_pass(const polar_pyramid & pyramid, const std::vector<tile_t> & tiles,
+        const sampling_options & sampling, const unsigned int threads)
+{
+    namespace pt = boost::posix_time;
+    using boost::get;
+
+    event_counter references(PERF_TYPE_HARDWARE,
+            PERF_COUNT_HW_CACHE_REFERENCES);
+    event_counter misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    event_counter l1d_misses(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+    std::vector<unsigned char> png;
+    references.start();
+    misses.start();
+    l1d_misses.start();
+    const pt::ptime start = pt::microsec_clock::universal_time();
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+        encode_colorized_tile(pyramid, get<0>(*iter), get<1>(*iter),
+                get<2>(*iter), png, threads, png_options(), sampling);
+
+    const pt::ptime stop = pt::microsec_clock::universal_time();
+    bench_result result;
+    result.l1d_read_misses = l1d_misses.stop();
+    result.cache_misses = misses.stop();
+    result.cache_references = references.stop();
+    result.seconds = (stop - start).total_microseconds() / 1e6;
+    return result;
+}
+
+std::string
+format_count(const long long count)
+{
+    return (count < 0 ? "n/a" : boost::lexical_cast<std::string>(count));
+}
+
+/*
+ * Renders the tiles of one zoom level that have echo on them, in raster
+ * order and in Z order, a few times over, and reports the best time of each
+ * with the cache counters of that pass.
+ */
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using boost::format;
+    using boost::get;
+    cout.sync_with_stdio(false);
+
+    // Optional leading --threads N (one by default), --sampling MODE, as
+    // one entry of a generate policy without the zoom level, --rounds N
+    // (three by default), and --isa LEVEL to run the dispatched loops at
+    // sse2, avx2 or avx512 rather than the highest level the machine has.
+    unsigned int threads = 1;
+    unsigned int rounds = 3;
+    sampling_options sampling;
+    for (;;)
+    {
+        if (argc > 2 && (std::string(argv[1]) == "--threads"
+                    || std::string(argv[1]) == "--rounds"))
+        {
+            try
+            {
+                (std::string(argv[1]) == "--threads" ? threads : rounds) =
+                    boost::lexical_cast<unsigned int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad " << argv[1] + 2 << " count" << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--sampling")
+        {
+            try
+            {
+                sampling = sampling_policy(std::string("0:") + argv[2])
+                    .at(0);
+            }
+            catch (sampling_policy_error & e)
+            {
+                cout << e.what() << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--isa")
+        {
+            try
+            {
+                force_isa_level(parse_isa_level(argv[2]));
+            }
+            catch (cpu_dispatch_error & e)
+            {
+                cout << e.what() << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else
+            break;
+    }
+
+    if (argc != 3)
+    {
+        cout
+            << "usage: render-bench [--threads N] [--sampling MODE] "
+               "[--rounds N] [--isa LEVEL]\n"
+               "                    <zoom> <basefile>"
+            << std::endl;
+        return 1;
+    }
+
+    int t_z;
+    try
+    {
+        t_z = boost::lexical_cast<int>(argv[1]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad zoomlevel" << std::endl;
+        return 1;
+    }
+
+    simple_cut cut;
+    {
+        std::ifstream ifs(argv[2], std::ios::binary);
+        boost::archive::binary_iarchive ia(ifs);
+        ia >> cut;
+    }
+
+    const polar_pyramid pyramid(cut);
+    const coverage_summary coverage(cut);
+
+    std::vector<tile_t> all_tiles, tiles;
+    find_intersecting_tiles(0, 0, 0, to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, t_z, all_tiles);
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = all_tiles.begin();
+            iter != all_tiles.end();
+            ++iter)
+        if (get<2>(*iter) == t_z && coverage.classify(get<0>(*iter),
+                    get<1>(*iter), t_z) != COVERAGE_EMPTY)
+            tiles.push_back(*iter);
+
+    const pixel_order orders[2] = { PIXELS_RASTER, PIXELS_Z_ORDER };
+    const char * order_names[2] = { "raster", "z-order" };
+    bench_result best[2];
+    for (unsigned int round = 0;
+            round != rounds;
+            ++round)
+        for (int k = 0;
+                k != 2;
+                ++k)
+        {
+            sampling.order = orders[k];
+            const bench_result result =
+                render_pass(pyramid, tiles, sampling, threads);
+            if (best[k].seconds < 0.0 || result.seconds < best[k].seconds)
+                best[k] = result;
+        }
+
+    cout << format("%1% tiles at zoom %2%, best of %3%, %4% (machine "
+            "supports %5%)\n")
+        % tiles.size() % t_z % rounds % isa_level_name(active_isa_level())
+        % isa_level_name(supported_isa_level());
+    cout << format("%|-8| %|10| %|16| %|16| %|16|\n")
+        % "order" % "seconds" % "cache refs" % "cache misses"
+        % "L1D misses";
+    for (int k = 0;
+            k != 2;
+            ++k)
+        cout << format("%|-8| %|10.3f| %|16| %|16| %|16|\n")
+            % order_names[k] % best[k].seconds
+            % format_count(best[k].cache_references)
+            % format_count(best[k].cache_misses)
+            % format_count(best[k].l1d_read_misses);
+    cout << std::flush;
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
+#include "coverage.hpp"
+#include "bounds_test.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+using namespace tile_generator;
+
+/*
+ * Checks the tile renderer against the GIL reference path: every tile with
+ * echo on it at the given zoom levels is rendered both ways, in each pixel
+ * order and on one and several threads, and the PNGs have to come out byte
+ * for byte the same, with the same answer for whether the tile is
+ * significant.
+ */
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using boost::format;
+    using boost::get;
+    cout.sync_with_stdio(false);
+
+    if (argc != 4)
+    {
+        cout << "usage: render-check <startzoom> <endzoom> <basefile>"
+            << std::endl;
+        return 1;
+    }
+
+    int start_zoom, end_zoom;
+    try
+    {
+        start_zoom = boost::lexical_cast<int>(argv[1]);
+        end_zoom = boost::lexical_cast<int>(argv[2]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad zoomlevel" << std::endl;
+        return 1;
+    }
+
+    simple_cut cut;
+    {
+        std::ifstream ifs(argv[3], std::ios::binary);
+        boost::archive::binary_iarchive ia(ifs);
+        ia >> cut;
+    }
+
+    const polar_pyramid pyramid(cut);
+    const coverage_summary coverage(cut);
+
+    std::vector<tile_t> tiles;
+    find_intersecting_tiles(0, 0, 0, to_rad(cut.latitude),
+            to_rad(cut.longitude), 300000.0, end_zoom, tiles);
+
+    const pixel_order orders[2] = { PIXELS_RASTER, PIXELS_Z_ORDER };
+    const unsigned int thread_counts[2] = { 1, 3 };
+    long checked = 0, mismatched = 0;
+
+    std::vector<tile_t>::const_iterator iter;
+    for (iter = tiles.begin();
+            iter != tiles.end();
+            ++iter)
+    {
+        long t_x, t_y;
+        int t_z;
+        boost::tie(t_x, t_y, t_z) = *iter;
+        if (t_z < start_zoom
+                || coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+            continue;
+
+        for (int k = 0;
+                k != 4;
+                ++k)
+        {
+            sampling_options sampling;
+            sampling.order = orders[k % 2];
+            const unsigned int threads = thread_counts[k / 2];
+
+            std::vector<unsigned char> png, reference_png;
+            const bool significant = encode_colorized_tile(pyramid, t_x, t_y,
+                    t_z, png, threads, png_options(), sampling);
+            const bool reference_significant =
+                encode_colorized_tile_reference(pyramid, t_x, t_y, t_z,
+                        reference_png, threads, png_options(), sampling);
+
+            ++checked;
+            if (png != reference_png
+                    || significant != reference_significant)
+            {
+                ++mismatched;
+                cout << format("%1%_%2%_%3%-%4% differs (%5% order, %6% "
+                        "threads)\n")
+                    % cut.radar_identifier % t_z % t_x % t_y
+                    % (k % 2 ? "z" : "raster") % threads;
+            }
+        }
+    }
+
+    cout << format("%1% renders checked, %2% differ from the reference\n")
+        % checked % mismatched << std::flush;
+
+    return (mismatched == 0 ? 0 : 1);
+}
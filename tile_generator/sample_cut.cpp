@@ -1,74 +1,199 @@
 #include <map>
+#include <vector>
 #include <cmath>
+#include <algorithm>
 #include <boost/tuple/tuple.hpp>
 
 #include "sample_cut.hpp"
 #include "geo_math.hpp"
+#include "polar_pyramid.hpp"
+#include "beam_geometry.hpp"
+#include "cpu_dispatch.hpp"
 #include "../base_extract/simple_cut.hpp"
 
 namespace tile_generator {
 
 /*
- * Get the interpreted value of a particular gate from a given radial. The
- * value is a tuple, with the first being the measured value ("Z") and the
- * second being the validity ("V", where 0.0 is invalid and 1.0 is valid).
+ * Whether none of the gates from first to last, inclusive, have data.
  */
 inline
-radar_value_t
-gate_val(const simple_radial & rad, int gate_idx)
-{
-    /*
-     * If the gate position is inside the cone of silence or outside the
-     * radar's range, return a completely invalid value with the measurement of
-     * the first gate or last gate respectively. This makes interpolation work
-     * correctly. (As the interpolation falls off the edge of the coverage
-     * area, it gradually changes from a valid to an invalid value with the
-     * same measurement, instead of the measurement spuriously falling off to
-     * zero.)
-     */
-    float z = 1.0;
-    if (gate_idx < 0)
+bool
+no_data_between(const data_runs_t & runs, const int first, const int last)
+{
+    // Find the first run that ends after the first gate, by bisection.
+    size_t lo = 0, hi = runs.size();
+    while (lo != hi)
     {
-        gate_idx = 0;
-        z = 0.0;
+        const size_t mid = (lo + hi) / 2;
+        if (runs[mid].stop <= first)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    else if (gate_idx > static_cast<int>(rad.gates.size()) - 1)
+
+    return lo == runs.size() || runs[lo].start > last;
+}
+
+/*
+ * The Gaussian's weights in Q15 at FIXED_KERNEL_TABLE_STEPS points per unit,
+ * out to where gaussian_power() clips and stays flat. The polynomial comes
+ * out a hair over one at the center, which Q15 can't hold, so that is
+ * clamped.
+ */
+struct fixed_kernel_table
+{
+    fixed_kernel_table()
     {
-        gate_idx = rad.gates.size() - 1;
-        z = 0.0;
+        const float X_LIMIT = 2.22726;
+        const int count =
+            static_cast<int>(X_LIMIT * FIXED_KERNEL_TABLE_STEPS) + 2;
+        for (int i = 0;
+                i != count;
+                ++i)
+            weights.push_back(static_cast<short>(std::min(FIXED_WEIGHT_ONE,
+                        FIXED_WEIGHT_ONE * gaussian_power(
+                            static_cast<float>(i) / FIXED_KERNEL_TABLE_STEPS)
+                        + 0.5f)));
     }
-        
-    const unsigned char gate = rad.gates[gate_idx];
-    if (gate == 0 || gate == 1)
-        return radar_value_t(0.0, 0.0);
-    else
-        return radar_value_t((gate - rad.offset) / rad.scale, z);
+
+    short operator()(const float x) const
+    {
+        const size_t i = static_cast<size_t>(
+                std::fabs(x) * FIXED_KERNEL_TABLE_STEPS + 0.5f);
+        return weights[std::min(i, weights.size() - 1)];
+    }
+
+    std::vector<short> weights;
+};
+
+const fixed_kernel_table fixed_kernel_weights;
+
+/*
+ * The sums of the fixed point kernel: a loop of 16 bit multiplies into 32
+ * bit accumulators with nothing else in it, which the compiler does with
+ * SIMD multiply-adds, twice as many gates to an instruction as in floating
+ * point. Built once per instruction set level.
+ */
+struct fixed_sums
+{
+    int z, v, coef;
+};
+
+inline
+fixed_sums
+sum_fixed_taps(const short * weights, const short * z, const short * v,
+        const int taps)
+{
+    fixed_sums sums = { 0, 0, 0 };
+    for (int i = 0;
+            i != taps;
+            ++i)
+    {
+        sums.z += weights[i] * z[i];
+        sums.v += weights[i] * v[i];
+        sums.coef += weights[i];
+    }
+    return sums;
+}
+
+fixed_sums
+sum_fixed_taps_sse2(const short * weights, const short * z,
+        const short * v, const int taps)
+{
+    return sum_fixed_taps(weights, z, v, taps);
+}
+
+RSME_TARGET_AVX2
+fixed_sums
+sum_fixed_taps_avx2(const short * weights, const short * z,
+        const short * v, const int taps)
+{
+    return sum_fixed_taps(weights, z, v, taps);
+}
+
+RSME_TARGET_AVX512
+fixed_sums
+sum_fixed_taps_avx512(const short * weights, const short * z,
+        const short * v, const int taps)
+{
+    return sum_fixed_taps(weights, z, v, taps);
+}
+
+/*
+ * Apply the Gaussian to gates near_idx to far_idx of a radial in fixed
+ * point, looking the weights up first and then summing them with the
+ * version of the loop for the active instruction set level. Returns false,
+ * leaving the value alone, if the weights add up to too little for the
+ * result to be trusted.
+ */
+bool
+sample_fixed_taps(const fixed_radial & fixed, const int near_idx,
+        const int far_idx, const float position, const float filter_scale,
+        radar_value_t & out)
+{
+    short weights[FIXED_KERNEL_MAX_TAPS];
+    const int taps = far_idx + 1 - near_idx;
+    for (int i = 0;
+            i != taps;
+            ++i)
+        weights[i] = fixed_kernel_weights(
+                (float(near_idx + i) - position) / filter_scale);
+
+    const short * z = &fixed.z[near_idx];
+    const short * v = &fixed.v[near_idx];
+    fixed_sums sums;
+    switch (active_isa_level())
+    {
+    case ISA_AVX512:
+        sums = sum_fixed_taps_avx512(weights, z, v, taps);
+        break;
+    case ISA_AVX2:
+        sums = sum_fixed_taps_avx2(weights, z, v, taps);
+        break;
+    default:
+        sums = sum_fixed_taps_sse2(weights, z, v, taps);
+        break;
+    }
+
+    if (sums.coef < FIXED_KERNEL_MIN_WEIGHT_SUM)
+        return false;
+
+    const float coef = static_cast<float>(sums.coef);
+    out = radar_value_t(sums.z / (coef * FIXED_Z_ONE),
+            sums.v / (coef * FIXED_V_ONE));
+    return true;
 }
 
 /*
  * Sample a radial using a 1/sqrt(2) gaussian filter of the specified width at
- * a given central angle from the radar site. The central angle is used instead
- * of the distance because the radials are individually corrected for slant
- * range.
+ * a given slant range along it. The range comes from the central angle from
+ * the radar site rather than the distance, because the radials are
+ * individually corrected for slant range.
+ *
+ * This works on any radial type for which there is a gate_val() overload, so
+ * it serves both the cut itself and the decimated pyramid levels. Given the
+ * radial's runs of data, it returns no data straight away if the kernel
+ * falls between them. Given its gates in fixed point, it filters them in
+ * integer arithmetic, unless the kernel is too wide or too far off the end
+ * of the radial for that.
  */
+template <typename Radial>
+RSME_DISPATCH_INLINE
 radar_value_t
-sample_radial_gaussian(const simple_radial & rad, const double central_angle,
-        const float filter_width_meters)
+sample_radial_gaussian_generic(const Radial & rad, const float range,
+        const float filter_width_meters, const data_runs_t * runs = 0,
+        const fixed_radial * fixed = 0)
 {
-    static const float WASHOUT_ALLOWANCE = 2.00; // samples
     using std::ceil;
     using boost::tie;
 
-    const float range =
-        inclined_slant_range(central_angle, to_rad(rad.elevation));
-
     const float filter_scale =
         (filter_width_meters > rad.range_res_meters
             ? filter_width_meters / rad.range_res_meters
             : 1.0);
     const float position =
         (range - rad.start_range_meters) / rad.range_res_meters;
-    
+
     int near_idx = static_cast<int>
         (position - ceil(filter_scale * WASHOUT_ALLOWANCE));
     int far_idx = static_cast<int>
@@ -78,10 +203,19 @@ sample_radial_gaussian(const simple_radial & rad, const double central_angle,
     if (far_idx > static_cast<int>(rad.gates.size()))
         far_idx = rad.gates.size();
 
+    const int last_gate = static_cast<int>(rad.gates.size()) - 1;
+    radar_value_t result;
     if (near_idx > static_cast<int>(rad.gates.size()))
         return gate_val(rad, near_idx);
     else if (far_idx < 0)
         return gate_val(rad, 0);
+    else if (runs && no_data_between(*runs, std::min(near_idx, last_gate),
+                std::min(far_idx, last_gate)))
+        return radar_value_t(0.0, 0.0);
+    else if (fixed && far_idx + 1 - near_idx <= FIXED_KERNEL_MAX_TAPS
+            && sample_fixed_taps(*fixed, near_idx, far_idx, position,
+                filter_scale, result))
+        return result;
     else
     {
         float z_accum = 0.0, v_accum = 0.0, coef_accum = 0.0;
@@ -102,30 +236,62 @@ sample_radial_gaussian(const simple_radial & rad, const double central_angle,
     }
 }
 
+radar_value_t
+sample_radial_gaussian(const simple_radial & rad, const double central_angle,
+        const float filter_width_meters)
+{
+    return sample_radial_gaussian_generic(rad,
+            inclined_slant_range(central_angle, to_rad(rad.elevation)),
+            filter_width_meters);
+}
+
 /*
- * Samples the value of the cut at the given lat/lon, in radians. The value is
- * filtered using using a 1/sqrt(2) gaussian filter of the specified width.
+ * Work out the bearing and central angle to the given lat/lon, in radians,
+ * from the site.
  */
-radar_value_t
-sample_gaussian(const simple_cut & cut, const double lat, const double lon,
+polar_point
+locate_polar(const simple_cut & cut, const double lat, const double lon)
+{
+    polar_point point;
+    point.theta_deg =
+        initial_bearing_deg(to_rad(cut.latitude), to_rad(cut.longitude),
+                lat, lon);
+    point.angular_distance =
+        central_angle(to_rad(cut.latitude), to_rad(cut.longitude), lat, lon);
+    return point;
+}
+
+/*
+ * Work out the bearing and distance to the given lat/lon, in radians, from the
+ * site, and the size of the filter kernel in azimuth and range needed there.
+ */
+kernel_geometry
+calculate_kernel_geometry(const simple_cut & cut, const double lat,
+        const double lon, const float filter_width_meters)
+{
+    return calculate_kernel_geometry(locate_polar(cut, lat, lon),
+            filter_width_meters);
+}
+
+/*
+ * Same as above, for a point already located relative to the site.
+ */
+kernel_geometry
+calculate_kernel_geometry(const polar_point & point,
         const float filter_width_meters)
 {
     static const float ANGULAR_RESOLUTION = 0.5; // degrees
     static const float RANGE_RESOLUTION = 250.0; // meters
     static const float MAX_FILTER_ASPECT = 2.0; // ratio
     static const float MAX_AZIMUTH_FILTER_SCALE = 20.0; // ratio
-    // 1/sqrt(2) gaussian needs two samples washout per side
-    static const float WASHOUT_ALLOWANCE = 2.00; // samples
-    using boost::get;
-    using boost::tie;
 
-    const float theta_deg = 
-        initial_bearing_deg(to_rad(cut.latitude), to_rad(cut.longitude),
-                lat, lon);
+    kernel_geometry kg;
+
+    kg.theta_deg = point.theta_deg;
     // Calculate angular distance from the radar site
-    const float angular_distance =
-        central_angle(to_rad(cut.latitude), to_rad(cut.longitude), lat, lon);
-    
+    kg.angular_distance = point.angular_distance;
+    const float angular_distance = kg.angular_distance;
+
     // Calculate azimuth filter width indicated by range distance.
     const float calculated_filter_width =
         to_rad(ANGULAR_RESOLUTION) * angular_distance * MEAN_EARTH_RADIUS;
@@ -140,22 +306,44 @@ sample_gaussian(const simple_cut & cut, const double lat, const double lon,
     // Calculate the azimuth filter scale factor. I'm not sure why this math
     // comes out twice as wide as it should, but it very obviously does, so
     // correct for it.
-    const float calculated_az_filter_scale = 
+    const float calculated_az_filter_scale =
         (effective_filter_width > (angular_distance * MEAN_EARTH_RADIUS)
             ? effective_filter_width / (angular_distance * MEAN_EARTH_RADIUS)
             : 1.0) * 0.5;
     // Prevent singularity at radar site causing rediculous scale values.
-    const float az_filter_scale = 
+    kg.az_filter_scale =
         (calculated_az_filter_scale < MAX_AZIMUTH_FILTER_SCALE
             ? calculated_az_filter_scale
             : MAX_AZIMUTH_FILTER_SCALE);
 
     // Select the wider of range filter widths indicated by range distance and
     // zoom level.
-    float range_filter_width =
+    kg.range_filter_width =
         effective_filter_width / MAX_FILTER_ASPECT;
-    if (range_filter_width < filter_width_meters)
-        range_filter_width = filter_width_meters;
+    if (kg.range_filter_width < filter_width_meters)
+        kg.range_filter_width = filter_width_meters;
+
+    return kg;
+}
+
+/*
+ * Apply the filter kernel described by the geometry to a set of radials. The
+ * radial map can be that of the cut itself or of a pyramid level. The runs
+ * of data and the fixed point gates, if given, are those of each radial in
+ * the map's order.
+ */
+template <typename RadialMap>
+RSME_DISPATCH_INLINE
+radar_value_t
+sample_kernel_generic(const RadialMap & radials, const kernel_geometry & kg,
+        const beam_geometry & beam,
+        const std::vector<data_runs_t> * data_runs = 0,
+        const std::vector<fixed_radial> * fixed = 0)
+{
+    using boost::tie;
+
+    const float theta_deg = kg.theta_deg;
+    const float az_filter_scale = kg.az_filter_scale;
 
     // Find the azimuth angles of the edges of the filter kernel
     float theta_start = theta_deg - (az_filter_scale * WASHOUT_ALLOWANCE);
@@ -164,24 +352,27 @@ sample_gaussian(const simple_cut & cut, const double lat, const double lon,
     if (theta_stop >= 360.0) theta_stop -= 360.0;
 
     // Get a range covering all radials inside the filter kernel
-    base_extract::simple_cut::radials_type::const_iterator
-        start_iter, stop_iter, iter, END;
-    start_iter = bounding_pair(cut.radials, theta_start).first;
-    stop_iter = bounding_pair(cut.radials, theta_stop).second;
-    END = cut.radials.end();
+    typename RadialMap::const_iterator start_iter, stop_iter, iter;
+    start_iter = bounding_pair(radials, theta_start).first;
+    stop_iter = bounding_pair(radials, theta_stop).second;
 
-    if (start_iter == cut.radials.end())
+    if (start_iter == radials.end())
         --start_iter;
-    if (stop_iter == cut.radials.end())
-        stop_iter = cut.radials.begin();
+    if (stop_iter == radials.end())
+        stop_iter = radials.begin();
+
+    const beam_position position = beam.locate(kg.angular_distance);
 
     float z_accum = 0.0, v_accum = 0.0, coef_accum = 0.0;
     float z, v, coef;
     for (iter = start_iter;
             iter != stop_iter;)
     {
-        tie(z, v) = sample_radial_gaussian(iter->second, angular_distance,
-                range_filter_width);
+        tie(z, v) = sample_radial_gaussian_generic(iter->second,
+                beam.slant_range(position, iter->second.elevation),
+                kg.range_filter_width,
+                (data_runs ? &(*data_runs)[iter - radials.begin()] : 0),
+                (fixed ? &(*fixed)[iter - radials.begin()] : 0));
         float x = iter->first - theta_deg;
         if (x > 180.0) x -= 360.0;
         if (x < -180.0) x += 360.0;
@@ -192,11 +383,224 @@ sample_gaussian(const simple_cut & cut, const double lat, const double lon,
         coef_accum += coef;
 
         ++iter;
-        if (iter == cut.radials.end())
-            iter = cut.radials.begin();
+        if (iter == radials.end())
+            iter = radials.begin();
     }
 
     return radar_value_t(z_accum / coef_accum, v_accum / coef_accum);
 }
 
+/*
+ * The same, built for each instruction set level, and picking the one for
+ * the active level. The whole kernel is inlined into each version, the
+ * filtering along each radial included, so that the floating point loops
+ * are compiled for the level along with the rest.
+ */
+template <typename RadialMap>
+radar_value_t
+sample_kernel_sse2(const RadialMap & radials, const kernel_geometry & kg,
+        const beam_geometry & beam, const std::vector<data_runs_t> * data_runs,
+        const std::vector<fixed_radial> * fixed)
+{
+    return sample_kernel_generic(radials, kg, beam, data_runs, fixed);
+}
+
+template <typename RadialMap>
+RSME_TARGET_AVX2
+radar_value_t
+sample_kernel_avx2(const RadialMap & radials, const kernel_geometry & kg,
+        const beam_geometry & beam, const std::vector<data_runs_t> * data_runs,
+        const std::vector<fixed_radial> * fixed)
+{
+    return sample_kernel_generic(radials, kg, beam, data_runs, fixed);
+}
+
+template <typename RadialMap>
+RSME_TARGET_AVX512
+radar_value_t
+sample_kernel_avx512(const RadialMap & radials, const kernel_geometry & kg,
+        const beam_geometry & beam, const std::vector<data_runs_t> * data_runs,
+        const std::vector<fixed_radial> * fixed)
+{
+    return sample_kernel_generic(radials, kg, beam, data_runs, fixed);
+}
+
+template <typename RadialMap>
+radar_value_t
+sample_kernel(const RadialMap & radials, const kernel_geometry & kg,
+        const beam_geometry & beam,
+        const std::vector<data_runs_t> * data_runs = 0,
+        const std::vector<fixed_radial> * fixed = 0)
+{
+    switch (active_isa_level())
+    {
+    case ISA_AVX512:
+        return sample_kernel_avx512(radials, kg, beam, data_runs, fixed);
+    case ISA_AVX2:
+        return sample_kernel_avx2(radials, kg, beam, data_runs, fixed);
+    default:
+        return sample_kernel_sse2(radials, kg, beam, data_runs, fixed);
+    }
+}
+
+/*
+ * Samples the value of the cut at the given lat/lon, in radians. The value is
+ * filtered using using a 1/sqrt(2) gaussian filter of the specified width.
+ */
+radar_value_t
+sample_gaussian(const simple_cut & cut, const double lat, const double lon,
+        const float filter_width_meters)
+{
+    return sample_kernel(cut.radials,
+            calculate_kernel_geometry(cut, lat, lon, filter_width_meters),
+            beam_geometry());
+}
+
+/*
+ * Same as above, but the kernel is applied to the pyramid level that matches
+ * its size, rather than always to the full resolution cut.
+ */
+radar_value_t
+sample_gaussian(const polar_pyramid & pyramid, const double lat,
+        const double lon, const float filter_width_meters)
+{
+    return sample_gaussian(pyramid, locate_polar(pyramid.base, lat, lon),
+            filter_width_meters);
+}
+
+/*
+ * Same as above, for a point already located relative to the site,
+ * filtering along the radials in fixed point if asked to.
+ */
+radar_value_t
+sample_gaussian(const polar_pyramid & pyramid, const polar_point & point,
+        const float filter_width_meters, const bool fixed_point)
+{
+    const kernel_geometry kg =
+        calculate_kernel_geometry(point, filter_width_meters);
+    int range_level, az_level;
+    boost::tie(range_level, az_level) =
+        pyramid.select_level(kg.range_filter_width, kg.az_filter_scale);
+
+    if (range_level == 0)
+        return sample_kernel(pyramid.base.radials, kg, pyramid.beam,
+                &pyramid.base_data_runs,
+                (fixed_point ? &pyramid.fixed(0, 0) : 0));
+    else
+    {
+        const decimated_cut & dc = pyramid.level(range_level, az_level);
+        return sample_kernel(dc.radials, kg, pyramid.beam, &dc.data_runs,
+                (fixed_point ? &pyramid.fixed(range_level, az_level) : 0));
+    }
+}
+
+/*
+ * Where a point falls among the radials of a cut: the radials either side of
+ * its bearing, and how far round from the first to the second it is (0 to
+ * 1). Returns false if the cut has no radials.
+ */
+bool
+locate_between_radials(const simple_cut & cut, const float theta_deg,
+        simple_cut::radials_type::const_iterator & lower,
+        simple_cut::radials_type::const_iterator & upper, float & mu)
+{
+    if (cut.radials.empty())
+        return false;
+
+    boost::tie(lower, upper) = bounding_pair(cut.radials, theta_deg);
+    if (upper == cut.radials.end())
+        upper = cut.radials.begin();
+    if (lower == cut.radials.end())
+        --lower;
+
+    float before = theta_deg - lower->first;
+    float after = upper->first - theta_deg;
+    if (before < 0.0) before += 360.0;
+    if (after < 0.0) after += 360.0;
+    mu = (before + after > 0.0 ? before / (before + after) : 0.0);
+
+    return true;
+}
+
+/*
+ * Position of a central angle, looked up in the cut's beam geometry, along a
+ * radial, in gates.
+ */
+inline
+float
+gate_position(const simple_radial & rad, const beam_position & position,
+        const beam_geometry & beam)
+{
+    const float range = beam.slant_range(position, rad.elevation);
+    return (range - rad.start_range_meters) / rad.range_res_meters;
+}
+
+/*
+ * Samples the cut at the given lat/lon, in radians, taking the gate the point
+ * falls in on the nearest radial.
+ */
+radar_value_t
+sample_nearest(const simple_cut & cut, const double lat, const double lon)
+{
+    return sample_nearest(cut, locate_polar(cut, lat, lon), beam_geometry());
+}
+
+radar_value_t
+sample_nearest(const simple_cut & cut, const polar_point & point,
+        const beam_geometry & beam)
+{
+    simple_cut::radials_type::const_iterator lower, upper;
+    float mu;
+    if (!locate_between_radials(cut, point.theta_deg, lower, upper, mu))
+        return radar_value_t(0.0, 0.0);
+
+    const simple_radial & rad = (mu < 0.5 ? lower : upper)->second;
+    return gate_val(rad, static_cast<int>(std::floor(
+                    gate_position(rad, beam.locate(point.angular_distance),
+                        beam) + 0.5)));
+}
+
+/*
+ * Samples the cut at the given lat/lon, in radians, interpolating linearly in
+ * range between the two nearest gates on each of the radials either side,
+ * and then linearly in azimuth between the two.
+ */
+radar_value_t
+sample_bilinear(const simple_cut & cut, const double lat, const double lon)
+{
+    return sample_bilinear(cut, locate_polar(cut, lat, lon),
+            beam_geometry());
+}
+
+radar_value_t
+sample_bilinear(const simple_cut & cut, const polar_point & point,
+        const beam_geometry & beam)
+{
+    simple_cut::radials_type::const_iterator lower, upper;
+    float mu;
+    if (!locate_between_radials(cut, point.theta_deg, lower, upper, mu))
+        return radar_value_t(0.0, 0.0);
+
+    const beam_position range = beam.locate(point.angular_distance);
+    radar_value_t values[2];
+    const simple_radial * rads[2] = { &lower->second, &upper->second };
+    for (int k = 0;
+            k != 2;
+            ++k)
+    {
+        const float position =
+            gate_position(*rads[k], range, beam);
+        const int idx = static_cast<int>(std::floor(position));
+        const radar_value_t near = gate_val(*rads[k], idx);
+        const radar_value_t far = gate_val(*rads[k], idx + 1);
+        values[k] = radar_value_t(
+                linear_interpolate(near.first, far.first, position - idx),
+                linear_interpolate(near.second, far.second, position - idx));
+    }
+
+    return radar_value_t(
+            linear_interpolate(values[0].first, values[1].first, mu),
+            linear_interpolate(values[0].second, values[1].second, mu));
+}
+
 } // namespace tile_generator
@@ -2,6 +2,7 @@
 #define RSME_INCLUDED_SAMPLE_CUT_HPP
 
 #include <cmath>
+#include <vector>
 #include <utility>
 
 #include "geo_math.hpp"
@@ -14,6 +15,142 @@ using base_extract::simple_cut;
 
 typedef std::pair<float, float> radar_value_t;
 
+// 1/sqrt(2) gaussian needs two samples washout per side
+const float WASHOUT_ALLOWANCE = 2.00; // samples
+
+struct polar_pyramid;
+class beam_geometry;
+
+/*
+ * Where a point is as seen from a site: its bearing, in degrees, and its
+ * central angle from the site, in radians.
+ */
+struct polar_point
+{
+    float theta_deg;
+    double angular_distance;
+};
+
+/*
+ * A run of gates along a radial that have data, from start up to but not
+ * including stop. A gate with no data is one that samples as (0, 0): below
+ * threshold or range folded, or in a pyramid level, averaged from only such
+ * gates. In clear air most of every radial is between runs, and the sampler
+ * skips any radial whose stretch under the kernel is.
+ */
+struct data_run
+{
+    unsigned short start, stop;
+};
+
+typedef std::vector<data_run> data_runs_t;
+
+/*
+ * Scales of the integer Gaussian kernel. Measurements are held in 16 bits as
+ * sixteenths of a dBZ, and validity in 16 bits as a fraction of 2048. Kernel
+ * weights are Q15 fractions, looked up from a table with this many entries
+ * per unit of filter scale. With those, a kernel of up to the given number
+ * of taps can't overflow its 32 bit sums, and a wider one, which only the
+ * coarsest pyramid level at the lowest zoom levels ever needs, is done in
+ * floating point instead. So is a kernel centered so far off the end of a
+ * radial that its weights add up to less than the given sum, where the
+ * rounding of the weights would start to show.
+ */
+const float FIXED_Z_ONE = 16.0;
+const float FIXED_V_ONE = 2048.0;
+const float FIXED_WEIGHT_ONE = 32767.0;
+const int FIXED_KERNEL_TABLE_STEPS = 256;
+const int FIXED_KERNEL_MAX_TAPS = 64;
+const int FIXED_KERNEL_MIN_WEIGHT_SUM = 8192;
+
+/*
+ * Largest difference between the integer kernel and the floating point one
+ * over any pixel, in dBZ and in validity, as measured by fixed-check over
+ * the sample volumes. Most of it comes from the weights being rounded and
+ * looked up at the table's spacing.
+ */
+const float FIXED_KERNEL_MAX_Z_ERROR_DBZ = 0.05;
+const float FIXED_KERNEL_MAX_V_ERROR = 0.002;
+
+/*
+ * A radial's gates in fixed point for the integer kernel, with one more
+ * gate past the end that has the last gate's measurement and no validity,
+ * as gate_val() gives for anything off the end. Measurements and validity
+ * are kept apart so the kernel's sums run over plain arrays of shorts.
+ */
+struct fixed_radial
+{
+    std::vector<short> z;
+    std::vector<short> v;
+};
+
+/*
+ * Polar geometry of the filter kernel centered on a particular lat/lon.
+ */
+struct kernel_geometry
+{
+    float theta_deg;
+    float angular_distance;
+    float az_filter_scale;
+    float range_filter_width;
+};
+
+/*
+ * How a point is sampled from a cut. The Gaussian filters over the whole
+ * footprint of a pixel. Nearest takes the gate the point falls in, and
+ * bilinear interpolates between the two nearest gates on each of the two
+ * nearest radials. Once a pixel is smaller than a gate those look much the
+ * same as the Gaussian, for a fraction of the cost.
+ */
+enum sampling_mode
+{
+    SAMPLE_GAUSSIAN,
+    SAMPLE_BILINEAR,
+    SAMPLE_NEAREST
+};
+
+/*
+ * The order the pixels of a tile are sampled in. Neighbouring pixels draw on
+ * much the same radials and gates. Row by row, each row has to bring back
+ * what the one above it used, where in Z order, which keeps the pixels
+ * sampled close together in time close together on the tile, those can stay
+ * in cache from one pixel to the next. That only pays once a cut and its
+ * pyramid no longer fit in the cache, so rows are the default; render-bench
+ * compares the two. The order makes no difference to the values.
+ */
+enum pixel_order
+{
+    PIXELS_RASTER,
+    PIXELS_Z_ORDER
+};
+
+/*
+ * How to sample the pixels of a tile. With oversampling, pixels where the
+ * value changes sharply are sampled at five points instead of one, which
+ * takes the blockiness off the cheaper modes. With approximate projection,
+ * pixels are located relative to the site by local_projection, to within
+ * a fraction of a meter, rather than exactly. With fixed point, the
+ * Gaussian filters along each radial in integer arithmetic, to within the
+ * bounds above. The pixel order only affects how fast the tile is sampled.
+ */
+struct sampling_options
+{
+    sampling_options(const sampling_mode the_mode = SAMPLE_GAUSSIAN,
+            const bool the_oversample = false,
+            const bool the_approximate = false,
+            const pixel_order the_order = PIXELS_RASTER,
+            const bool the_fixed_point = false)
+        : mode(the_mode), oversample(the_oversample),
+            approximate(the_approximate), order(the_order),
+            fixed_point(the_fixed_point) { }
+
+    sampling_mode mode;
+    bool oversample;
+    bool approximate;
+    pixel_order order;
+    bool fixed_point;
+};
+
 inline radar_value_t gate_val(const simple_radial & rad, int gate_idx);
 radar_value_t sample_radial(const simple_radial & rad,
         const double central_angle);
@@ -21,8 +158,68 @@ radar_value_t sample_radial_gaussian(const simple_radial & rad,
         const double central_angle, const float filter_width_meters);
 radar_value_t sample(const simple_cut & cut, const double lat,
         const double lon);
+polar_point locate_polar(const simple_cut & cut, const double lat,
+        const double lon);
+kernel_geometry calculate_kernel_geometry(const simple_cut & cut,
+        const double lat, const double lon, const float filter_width_meters);
+kernel_geometry calculate_kernel_geometry(const polar_point & point,
+        const float filter_width_meters);
 radar_value_t sample_gaussian(const simple_cut & cut, const double lat,
         const double lon, const float filter_width_meters);
+radar_value_t sample_gaussian(const polar_pyramid & pyramid, const double lat,
+        const double lon, const float filter_width_meters);
+radar_value_t sample_gaussian(const polar_pyramid & pyramid,
+        const polar_point & point, const float filter_width_meters,
+        const bool fixed_point = false);
+radar_value_t sample_nearest(const simple_cut & cut, const double lat,
+        const double lon);
+radar_value_t sample_nearest(const simple_cut & cut,
+        const polar_point & point, const beam_geometry & beam);
+radar_value_t sample_bilinear(const simple_cut & cut, const double lat,
+        const double lon);
+radar_value_t sample_bilinear(const simple_cut & cut,
+        const polar_point & point, const beam_geometry & beam);
+
+/*
+ * Get the interpreted value of a particular gate from a given radial. The
+ * value is a tuple, with the first being the measured value ("Z") and the
+ * second being the validity ("V", where 0.0 is invalid and 1.0 is valid).
+ * A radial with no gates at all has no data anywhere.
+ */
+inline
+radar_value_t
+gate_val(const simple_radial & rad, int gate_idx)
+{
+    /*
+     * If the gate position is inside the cone of silence or outside the
+     * radar's range, return a completely invalid value with the measurement of
+     * the first gate or last gate respectively. This makes interpolation work
+     * correctly. (As the interpolation falls off the edge of the coverage
+     * area, it gradually changes from a valid to an invalid value with the
+     * same measurement, instead of the measurement spuriously falling off to
+     * zero.)
+     */
+    if (rad.gates.empty())
+        return radar_value_t(0.0, 0.0);
+
+    float z = 1.0;
+    if (gate_idx < 0)
+    {
+        gate_idx = 0;
+        z = 0.0;
+    }
+    else if (gate_idx > static_cast<int>(rad.gates.size()) - 1)
+    {
+        gate_idx = rad.gates.size() - 1;
+        z = 0.0;
+    }
+        
+    const unsigned char gate = rad.gates[gate_idx];
+    if (gate == 0 || gate == 1)
+        return radar_value_t(0.0, 0.0);
+    else
+        return radar_value_t((gate - rad.offset) / rad.scale, z);
+}
 
 /*
  * Produce an interpolated value between y1 and y2 using the cosine
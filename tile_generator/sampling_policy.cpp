@@ -0,0 +1,99 @@
+#include <map>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <boost/lexical_cast.hpp>
+
+#include "sampling_policy.hpp"
+
+namespace tile_generator {
+
+/*
+ * Parse one MODE[+FLAG...] out of a policy.
+ */
+sampling_options
+parse_sampling_options(const std::string & text)
+{
+    std::istringstream parts(text);
+    std::string mode_name, flag;
+    std::getline(parts, mode_name, '+');
+
+    sampling_options options;
+    if (mode_name == "gaussian")
+        options.mode = SAMPLE_GAUSSIAN;
+    else if (mode_name == "bilinear")
+        options.mode = SAMPLE_BILINEAR;
+    else if (mode_name == "nearest")
+        options.mode = SAMPLE_NEAREST;
+    else
+        throw sampling_policy_error("unknown sampling mode '" + text + "'");
+
+    while (std::getline(parts, flag, '+'))
+    {
+        if (flag == "oversample")
+            options.oversample = true;
+        else if (flag == "approx")
+            options.approximate = true;
+        else if (flag == "zorder")
+            options.order = PIXELS_Z_ORDER;
+        else if (flag == "fixed")
+            options.fixed_point = true;
+        else
+            throw sampling_policy_error("unknown sampling option '" + flag
+                    + "'");
+    }
+
+    return options;
+}
+
+sampling_policy::sampling_policy()
+{
+    table[std::numeric_limits<int>::min()] = sampling_options();
+}
+
+sampling_policy::sampling_policy(const std::string & spec)
+{
+    table[std::numeric_limits<int>::min()] = sampling_options();
+
+    std::istringstream entries(spec);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        const std::string::size_type colon = entry.find(':');
+        if (colon == std::string::npos)
+            throw sampling_policy_error("sampling entry '" + entry
+                    + "' is not ZOOM:MODE");
+
+        int zoom;
+        try
+        {
+            zoom = boost::lexical_cast<int>(entry.substr(0, colon));
+        }
+        catch (boost::bad_lexical_cast & e)
+        {
+            throw sampling_policy_error("bad zoomlevel in sampling entry '"
+                    + entry + "'");
+        }
+
+        set(zoom, parse_sampling_options(entry.substr(colon + 1)));
+    }
+}
+
+/*
+ * Sample zoom levels from_zoom on (until the next entry) as given.
+ */
+void
+sampling_policy::set(const int from_zoom, const sampling_options & options)
+{
+    table[from_zoom] = options;
+}
+
+const sampling_options &
+sampling_policy::at(const int zoom) const
+{
+    table_t::const_iterator iter = table.upper_bound(zoom);
+    --iter;
+    return iter->second;
+}
+
+} // namespace tile_generator
@@ -0,0 +1,58 @@
+#ifndef RSME_INCLUDED_SAMPLING_POLICY_HPP
+#define RSME_INCLUDED_SAMPLING_POLICY_HPP
+
+#include <map>
+#include <string>
+#include <exception>
+
+#include "sample_cut.hpp"
+
+namespace tile_generator {
+
+class sampling_policy_error : public std::exception
+{
+public:
+    explicit sampling_policy_error(const std::string & the_message)
+        : message(the_message) { }
+    ~sampling_policy_error() throw() { }
+
+    virtual const char * what(void) const throw()
+    {
+        return message.c_str();
+    }
+
+private:
+    std::string message;
+};
+
+/*
+ * Which way to sample the tiles of each zoom level, so the cheaper modes can
+ * be used where they look no different, usually the deepest levels. Each
+ * entry applies from its zoom level down to the next entry's. By default
+ * every level gets the full Gaussian.
+ *
+ * A policy can be given as text, a comma separated list of ZOOM:MODE
+ * entries, where the mode is gaussian, bilinear or nearest, optionally
+ * followed by any of +oversample, +approx for approximate projection,
+ * +zorder to sample the pixels in Z order rather than row by row, and
+ * +fixed for the Gaussian's integer kernel. For
+ * example "12:bilinear,14:nearest+oversample" keeps the Gaussian down to
+ * zoom 11, uses bilinear for 12 and 13, and oversampled nearest from 14 on.
+ */
+class sampling_policy
+{
+public:
+    sampling_policy();
+    explicit sampling_policy(const std::string & spec);
+
+    void set(const int from_zoom, const sampling_options & options);
+    const sampling_options & at(const int zoom) const;
+
+private:
+    typedef std::map<int, sampling_options> table_t;
+    table_t table;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_SAMPLING_POLICY_HPP
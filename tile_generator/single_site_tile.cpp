@@ -1,16 +1,540 @@
+#include <algorithm>
+#include <string>
+#include <deque>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
 #include <boost/gil/typedefs.hpp>
 #include <boost/gil/virtual_locator.hpp>
 #include <boost/gil/image_view.hpp>
 #include <boost/gil/extension/io/png_io.hpp>
+#include <boost/gil/image.hpp>
+#include <boost/gil/algorithm.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "tile_coord.hpp"
 #include "single_site_tile.hpp"
+#include "polar_pyramid.hpp"
+#include "value_tile.hpp"
+#include "cpu_dispatch.hpp"
 #include "../base_extract/simple_cut.hpp"
 
 namespace tile_generator {
 
 namespace gil = boost::gil;
 
+/*
+ * File name suffix for each tile format.
+ */
+const char *
+tile_suffix(const tile_format format)
+{
+    return (format == TILE_DATA ? ".data.png" : ".png");
+}
+
+/*
+ * Where the batch generators put a tile: out/SITE_z_x-y.png, or
+ * out/SITE_z_x-y.data.png for a data tile. The name can be anything standing
+ * in for a site, such as the name of a mosaic.
+ */
+std::string
+tile_output_path(const std::string & name, const long t_x, const long t_y,
+        const int t_z, const tile_format format)
+{
+    using boost::lexical_cast;
+    using std::string;
+
+    return "out/"
+        + name + "_"
+        + lexical_cast<string>(t_z) + "_"
+        + lexical_cast<string>(t_x) + "-"
+        + lexical_cast<string>(t_y) + tile_suffix(format);
+}
+
+std::string
+tile_output_path(const base_extract::simple_cut & cut, const long t_x,
+        const long t_y, const int t_z, const tile_format format)
+{
+    return tile_output_path(cut.radar_identifier, t_x, t_y, t_z, format);
+}
+
+/*
+ * Where the batch generators put the one fully transparent tile that every
+ * tile with no echo on it is linked to: out/SITE_empty.png
+ */
+std::string
+empty_tile_path(const std::string & name, const tile_format format)
+{
+    return "out/" + name + "_empty" + tile_suffix(format);
+}
+
+std::string
+empty_tile_path(const base_extract::simple_cut & cut,
+        const tile_format format)
+{
+    return empty_tile_path(cut.radar_identifier, format);
+}
+
+void
+write_empty_tile(const char * filename, const tile_format format)
+{
+    std::vector<unsigned char> png;
+    encode_empty_tile(png, format);
+    write_png_buffer(png, filename);
+}
+
+void
+encode_empty_tile(std::vector<unsigned char> & png, const tile_format format)
+{
+    if (format == TILE_DATA)
+        encode_data_tile(value_tile(), png);
+    else
+    {
+        gil::rgba8_image_t img(TILE_DIMENSION_PIXELS, TILE_DIMENSION_PIXELS);
+        gil::fill_pixels(gil::view(img), gil::rgba8_pixel_t(0, 0, 0, 0));
+        encode_png(gil::const_view(img), png);
+    }
+}
+
+/*
+ * Put the shared empty tile in place under a tile's own name. This is a hard
+ * link where possible, so a sweep over mostly empty zoom levels costs one
+ * directory entry per tile, and falls back to copying the tile if the link
+ * can't be made.
+ */
+void
+link_empty_tile(const std::string & empty_path, const std::string & filename)
+{
+    std::remove(filename.c_str());
+    if (::link(empty_path.c_str(), filename.c_str()) != 0)
+    {
+        std::ifstream ifs(empty_path.c_str(), std::ios::binary);
+        std::ofstream ofs(filename.c_str(), std::ios::binary);
+        ofs << ifs.rdbuf();
+    }
+}
+
+tile_sampler::tile_sampler(const polar_pyramid & the_pyramid,
+        const long tile_x, const long tile_y, const int tile_z,
+        const sampling_options & the_sampling)
+    : pyramid(the_pyramid), t_x(tile_x), t_y(tile_y), t_z(tile_z),
+        sampling(the_sampling),
+        projection(to_rad(static_cast<double>(the_pyramid.base.latitude)),
+                to_rad(static_cast<double>(the_pyramid.base.longitude))),
+        grid(new pixel_grid(tile_x, tile_y, tile_z))
+{
+    locate_centers();
+}
+
+/*
+ * Sample a tile inside the block the grid covers.
+ */
+tile_sampler::tile_sampler(const polar_pyramid & the_pyramid,
+        const boost::shared_ptr<const pixel_grid> & the_grid,
+        const long tile_x, const long tile_y,
+        const sampling_options & the_sampling)
+    : pyramid(the_pyramid), t_x(tile_x), t_y(tile_y), t_z(the_grid->t_z),
+        sampling(the_sampling),
+        projection(to_rad(static_cast<double>(the_pyramid.base.latitude)),
+                to_rad(static_cast<double>(the_pyramid.base.longitude))),
+        grid(the_grid)
+{
+    locate_centers();
+}
+
+void
+tile_sampler::locate_centers(void)
+{
+    row_lat = &grid->lat[(t_y - grid->t_y) * TILE_DIMENSION_PIXELS];
+    column_lon = &grid->lon[(t_x - grid->t_x) * TILE_DIMENSION_PIXELS];
+    row_height =
+        &grid->row_height_meters[(t_y - grid->t_y) * TILE_DIMENSION_PIXELS];
+
+    if (sampling.approximate)
+    {
+        projected_tile * tile = new projected_tile;
+        centers.reset(tile);
+        projection.project_tile(*grid, t_x, t_y, *tile);
+    }
+}
+
+radar_value_t
+tile_sampler::operator()(const double d_x, const double d_y) const
+{
+    using boost::tie;
+
+    double lat, lon;
+    tie(lat, lon) = pixel_mercator_to_latlon(t_x, t_y, d_x, d_y, t_z);
+
+    return sample_at(sampling.approximate
+                ? projection.project(lat, lon)
+                : locate_polar(pyramid.base, lat, lon),
+            pixel_height_meters(t_y, d_y - 0.5, t_z));
+}
+
+radar_value_t
+tile_sampler::sample_at(const polar_point & point,
+        const float filter_width_meters) const
+{
+    switch (sampling.mode)
+    {
+    case SAMPLE_NEAREST:
+        return sample_nearest(pyramid.base, point, pyramid.beam);
+    case SAMPLE_BILINEAR:
+        return sample_bilinear(pyramid.base, point, pyramid.beam);
+    default:
+        return sample_gaussian(pyramid, point, filter_width_meters,
+                sampling.fixed_point);
+    }
+}
+
+/*
+ * Sample the pixel at x, y. Normally this is the value at its center. With
+ * oversampling, the center and one more point are sampled first, and if
+ * they differ by enough that the pixel is on an edge, three more are sampled
+ * and the five are blended with gaussian weights. The points are spread
+ * around the center in a square rotated 22.5 degrees, so no two of them
+ * share a row or column of pixels.
+ */
+radar_value_t
+tile_sampler::pixel(const int x, const int y) const
+{
+    radar_value_t center;
+    if (centers)
+    {
+        const int i = y * TILE_DIMENSION_PIXELS + x;
+        polar_point point;
+        point.theta_deg = centers->theta_deg[i];
+        point.angular_distance = centers->angular_distance[i];
+        center = sample_at(point, row_height[y]);
+    }
+    else
+        center = sample_at(locate_polar(pyramid.base, row_lat[y],
+                    column_lon[x]), row_height[y]);
+
+    if (!sampling.oversample)
+        return center;
+
+    const radar_value_t first = (*this)(x + 1.4239, y + 0.1173);
+    if (std::fabs(first.first - center.first) < OVERSAMPLE_MIN_Z_STEP
+            && std::fabs(first.second - center.second)
+                < OVERSAMPLE_MIN_V_STEP)
+        return center;
+
+    const radar_value_t res[3] = {
+        (*this)(x + 0.1173, y - 0.4239),
+        (*this)(x - 0.4239, y + 0.8827),
+        (*this)(x + 0.8827, y + 1.4239)
+    };
+
+    return radar_value_t(
+            center.first * 0.5 + (first.first + res[0].first
+                + res[1].first + res[2].first) * 0.125,
+            center.second * 0.5 + (first.second + res[0].second
+                + res[1].second + res[2].second) * 0.125);
+}
+
+/*
+ * Rows per band when a tile is split between threads. Bands are dealt out to
+ * the threads round-robin, so the expensive rows (the ones crossing the
+ * coverage area) end up spread across all of them.
+ */
+const int TILE_BAND_ROWS = 8;
+
+/*
+ * Copies every nth band of rows, starting at the given band, from a source
+ * view into a destination view of the same dimensions.
+ */
+template <typename SrcView, typename DstView>
+struct band_copier
+{
+    band_copier(const SrcView & the_src, const DstView & the_dst,
+            const int first_band, const int band_stride)
+        : src(the_src), dst(the_dst), first(first_band), stride(band_stride)
+        { }
+
+    void operator()(void) const
+    {
+        const int width = static_cast<int>(src.width());
+        const int height = static_cast<int>(src.height());
+
+        for (int y = first * TILE_BAND_ROWS;
+                y < height;
+                y += stride * TILE_BAND_ROWS)
+        {
+            const int rows = std::min(TILE_BAND_ROWS, height - y);
+            gil::copy_pixels(gil::subimage_view(src, 0, y, width, rows),
+                    gil::subimage_view(dst, 0, y, width, rows));
+        }
+    }
+
+    SrcView src;
+    DstView dst;
+    int first, stride;
+};
+
+/*
+ * Pixels per chunk when a tile is rendered in Z order. The first this many
+ * pixels along the curve make a 32x32 square, and so does each run of this
+ * many after them. Chunks are dealt out to the threads round-robin, the
+ * same as bands.
+ */
+const int TILE_Z_ORDER_CHUNK_PIXELS = 1024;
+
+/*
+ * Samples every nth chunk of pixels along the Z-order curve, starting at the
+ * given chunk, into a destination view of a whole tile. This calls the
+ * virtual view's function directly, because going through the view for
+ * each pixel would copy the function, shared pointers and all, every time.
+ */
+template <typename Deref, typename DstView>
+struct z_order_copier
+{
+    z_order_copier(const Deref & the_src, const DstView & the_dst,
+            const int first_chunk, const int chunk_stride)
+        : src(the_src), dst(the_dst), first(first_chunk),
+            stride(chunk_stride) { }
+
+    void operator()(void) const
+    {
+        const int pixels = TILE_DIMENSION_PIXELS * TILE_DIMENSION_PIXELS;
+
+        for (int chunk = first * TILE_Z_ORDER_CHUNK_PIXELS;
+                chunk < pixels;
+                chunk += stride * TILE_Z_ORDER_CHUNK_PIXELS)
+            for (int i = chunk;
+                    i != chunk + TILE_Z_ORDER_CHUNK_PIXELS;
+                    ++i)
+            {
+                int x, y;
+                z_order_pixel(i, x, y);
+                dst(x, y) = src(typename Deref::point_t(x, y));
+            }
+    }
+
+    Deref src;
+    DstView dst;
+    int first, stride;
+};
+
+/*
+ * Render a virtual view of a tile into a buffer image in the given order,
+ * using the given number of threads.
+ */
+template <typename SrcView, typename Image>
+void
+render_tile_view(const SrcView & src, Image & buf, const pixel_order order,
+        const unsigned int threads)
+{
+    typedef typename Image::view_t dst_view_t;
+    typedef typename SrcView::locator::deref_fn_t deref_t;
+    typedef z_order_copier<deref_t, dst_view_t> z_order_copier_t;
+
+    if (threads <= 1)
+    {
+        if (order == PIXELS_Z_ORDER)
+            z_order_copier_t(src.pixels().deref_fn(), gil::view(buf), 0, 1)();
+        else
+            gil::copy_pixels(src, gil::view(buf));
+        return;
+    }
+
+    boost::thread_group group;
+    for (unsigned int k = 0;
+            k != threads;
+            ++k)
+        if (order == PIXELS_Z_ORDER)
+            group.create_thread(z_order_copier_t(src.pixels().deref_fn(),
+                        gil::view(buf), k, threads));
+        else
+            group.create_thread(band_copier<SrcView, dst_view_t>(src,
+                        gil::view(buf), k, threads));
+    group.join_all();
+}
+
+/*
+ * Tone map a run of values into pixels with the given operator, returning
+ * whether any of them came out non-transparent. Like the sampling loops,
+ * this is built for each instruction set level, and the version for the
+ * active one is picked once per run.
+ */
+template <typename Tmo>
+inline
+bool
+tone_map_run(const Tmo & tmo, const radar_value_t * values, const int count,
+        gil::rgba8_pixel_t * out)
+{
+    bool any = false;
+    for (int i = 0;
+            i != count;
+            ++i)
+    {
+        out[i] = tmo(values[i]);
+        any |= (gil::semantic_at_c<3>(out[i]) > 0);
+    }
+    return any;
+}
+
+template <typename Tmo>
+bool
+tone_map_run_sse2(const Tmo & tmo, const radar_value_t * values,
+        const int count, gil::rgba8_pixel_t * out)
+{
+    return tone_map_run(tmo, values, count, out);
+}
+
+template <typename Tmo>
+RSME_TARGET_AVX2
+bool
+tone_map_run_avx2(const Tmo & tmo, const radar_value_t * values,
+        const int count, gil::rgba8_pixel_t * out)
+{
+    return tone_map_run(tmo, values, count, out);
+}
+
+template <typename Tmo>
+RSME_TARGET_AVX512
+bool
+tone_map_run_avx512(const Tmo & tmo, const radar_value_t * values,
+        const int count, gil::rgba8_pixel_t * out)
+{
+    return tone_map_run(tmo, values, count, out);
+}
+
+template <typename Tmo>
+bool
+tone_map_run_dispatched(const Tmo & tmo, const radar_value_t * values,
+        const int count, gil::rgba8_pixel_t * out)
+{
+    switch (active_isa_level())
+    {
+    case ISA_AVX512:
+        return tone_map_run_avx512(tmo, values, count, out);
+    case ISA_AVX2:
+        return tone_map_run_avx2(tmo, values, count, out);
+    default:
+        return tone_map_run_sse2(tmo, values, count, out);
+    }
+}
+
+/*
+ * Samples every nth band of rows of a tile, or every nth chunk of its Z-order
+ * curve, starting at the given one, straight into an image buffer with the
+ * given tone mapping operator. Each row or chunk is sampled into a run of
+ * values first and then tone mapped in one go, so the tone mapping is a
+ * plain loop over an array rather than a call per pixel through a view.
+ * Notes whether any pixel it wrote came out non-transparent.
+ */
+template <typename Tmo>
+struct tile_renderer
+{
+    tile_renderer(const tile_sampler & the_sampler,
+            const gil::rgba8_view_t & the_dst, const int first_batch,
+            const int batch_stride, bool & the_significant)
+        : sampler(the_sampler), dst(the_dst), first(first_batch),
+            stride(batch_stride), significant(the_significant) { }
+
+    void operator()(void) const
+    {
+        const int n = TILE_DIMENSION_PIXELS;
+        std::vector<radar_value_t> values;
+        std::vector<int> xs, ys;
+        bool any = false;
+
+        if (sampler.sampling.order == PIXELS_Z_ORDER)
+        {
+            values.resize(TILE_Z_ORDER_CHUNK_PIXELS);
+            xs.resize(TILE_Z_ORDER_CHUNK_PIXELS);
+            ys.resize(TILE_Z_ORDER_CHUNK_PIXELS);
+
+            for (int chunk = first * TILE_Z_ORDER_CHUNK_PIXELS;
+                    chunk < n * n;
+                    chunk += stride * TILE_Z_ORDER_CHUNK_PIXELS)
+            {
+                for (int i = 0;
+                        i != TILE_Z_ORDER_CHUNK_PIXELS;
+                        ++i)
+                {
+                    z_order_pixel(chunk + i, xs[i], ys[i]);
+                    values[i] = sampler.pixel(xs[i], ys[i]);
+                }
+                for (int i = 0;
+                        i != TILE_Z_ORDER_CHUNK_PIXELS;
+                        ++i)
+                    any |= put(values[i], dst(xs[i], ys[i]));
+            }
+        }
+        else
+        {
+            values.resize(n);
+
+            for (int y = first * TILE_BAND_ROWS;
+                    y < n;
+                    y += stride * TILE_BAND_ROWS)
+                for (int row = y;
+                        row != std::min(y + TILE_BAND_ROWS, n);
+                        ++row)
+                {
+                    for (int x = 0;
+                            x != n;
+                            ++x)
+                        values[x] = sampler.pixel(x, row);
+
+                    any |= tone_map_run_dispatched(tmo, &values[0], n,
+                            &dst.row_begin(row)[0]);
+                }
+        }
+
+        significant = any;
+    }
+
+    bool put(const radar_value_t & rv, gil::rgba8_pixel_t & out) const
+    {
+        out = tmo(rv);
+        return gil::semantic_at_c<3>(out) > 0;
+    }
+
+    const tile_sampler & sampler;
+    gil::rgba8_view_t dst;
+    int first, stride;
+    bool & significant;
+    Tmo tmo;
+};
+
+/*
+ * Render a tile into an image buffer with the given tone mapping operator,
+ * using the given number of threads. Returns whether any pixel came out
+ * non-transparent.
+ */
+template <typename Tmo>
+bool
+render_tile(const tile_sampler & sampler, const gil::rgba8_view_t & dst,
+        const unsigned int threads)
+{
+    if (threads <= 1)
+    {
+        bool significant = false;
+        tile_renderer<Tmo>(sampler, dst, 0, 1, significant)();
+        return significant;
+    }
+
+    // A deque, since the renderers hold references into it.
+    std::deque<bool> significant(threads, false);
+    boost::thread_group group;
+    for (unsigned int k = 0;
+            k != threads;
+            ++k)
+        group.create_thread(tile_renderer<Tmo>(sampler, dst, k, threads,
+                    significant[k]));
+    group.join_all();
+
+    return std::find(significant.begin(), significant.end(), true)
+        != significant.end();
+}
+
 void
 write_green_tile(const base_extract::simple_cut & cut, const long t_x,
         const long t_y, const int t_z, const char * filename)
@@ -21,15 +545,127 @@ write_green_tile(const base_extract::simple_cut & cut, const long t_x,
     typedef gil::virtual_2d_locator<deref_t, false> locator_t;
     typedef gil::image_view<locator_t>              virt_view_t;
 
+    // No decimated levels, the green tiles are for looking at raw data.
+    const polar_pyramid pyramid(cut, 0);
     point_t dim(TILE_DIMENSION_PIXELS, TILE_DIMENSION_PIXELS);
     virt_view_t view(dim, locator_t(point_t(0, 0), point_t(1, 1),
-                deref_t(cut, t_x, t_y, t_z)));
+                deref_t(pyramid, t_x, t_y, t_z)));
     gil::png_write_view(filename, view);
 }
 
 bool
 write_colorized_tile(const base_extract::simple_cut & cut, const long t_x,
         const long t_y, const int t_z, const char * filename)
+{
+    return write_colorized_tile(polar_pyramid(cut), t_x, t_y, t_z, filename);
+}
+
+/*
+ * Callers writing more than one tile from the same cut should build the
+ * pyramid once and use this version.
+ */
+bool
+write_colorized_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, const char * filename,
+        const unsigned int threads)
+{
+    std::vector<unsigned char> png;
+    const bool significant =
+        encode_colorized_tile(pyramid, t_x, t_y, t_z, png, threads);
+    write_png_buffer(png, filename);
+
+    return significant;
+}
+
+/*
+ * Write a tile in the given format. Either way, returns whether any pixel
+ * came out non-transparent under the colorized TMO.
+ */
+bool
+write_tile(const polar_pyramid & pyramid, const long t_x, const long t_y,
+        const int t_z, const char * filename, const tile_format format,
+        const unsigned int threads, const sampling_options & sampling)
+{
+    std::vector<unsigned char> png;
+    const bool significant =
+        encode_tile(pyramid, t_x, t_y, t_z, png, format, threads, sampling);
+    write_png_buffer(png, filename);
+
+    return significant;
+}
+
+/*
+ * Same as above, but into a buffer. Data tiles are sampled on one thread.
+ */
+bool
+encode_tile(const polar_pyramid & pyramid, const long t_x, const long t_y,
+        const int t_z, std::vector<unsigned char> & png,
+        const tile_format format, const unsigned int threads,
+        const sampling_options & sampling)
+{
+    return encode_tile(tile_sampler(pyramid, t_x, t_y, t_z, sampling), png,
+            format, threads);
+}
+
+/*
+ * Same as above, with the tile and how to sample it given by a sampler.
+ */
+bool
+encode_tile(const tile_sampler & sampler, std::vector<unsigned char> & png,
+        const tile_format format, const unsigned int threads)
+{
+    if (format == TILE_DATA)
+    {
+        value_tile values;
+        sample_value_tile(sampler, values);
+        return encode_data_tile(values, png);
+    }
+    else
+        return encode_colorized_tile(sampler, png, threads);
+}
+
+/*
+ * Render a tile and encode it as a PNG into a buffer. The tile is sampled
+ * into an image first, since the palette can't be built until every pixel is
+ * known, in the order the sampling options ask for. With more than one
+ * thread, it is sampled in bands of rows, or chunks of the Z-order curve, in
+ * parallel.
+ */
+bool
+encode_colorized_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, std::vector<unsigned char> & png,
+        const unsigned int threads, const png_options & options,
+        const sampling_options & sampling)
+{
+    return encode_colorized_tile(tile_sampler(pyramid, t_x, t_y, t_z,
+                sampling), png, threads, options);
+}
+
+bool
+encode_colorized_tile(const tile_sampler & sampler,
+        std::vector<unsigned char> & png, const unsigned int threads,
+        const png_options & options)
+{
+    typedef colorized_tmo<gil::rgba8_pixel_t> tmo_t;
+
+    gil::rgba8_image_t buf(TILE_DIMENSION_PIXELS, TILE_DIMENSION_PIXELS);
+    const bool significant =
+        render_tile<tmo_t>(sampler, gil::view(buf), threads);
+    encode_png(gil::const_view(buf), png, options);
+
+    return significant;
+}
+
+/*
+ * Same as above, but pulling the pixels one at a time through a GIL virtual
+ * view over sampled_cut, the way tiles used to be rendered. This is only
+ * kept to check the renderer above against; render-check compares the two.
+ */
+bool
+encode_colorized_tile_reference(const polar_pyramid & pyramid,
+        const long t_x, const long t_y, const int t_z,
+        std::vector<unsigned char> & png, const unsigned int threads,
+        const png_options & options, const sampling_options & sampling)
 {
     typedef sampled_cut< gil::rgba8_pixel_t,
             colorized_tmo<gil::rgba8_pixel_t> >     deref_t;
@@ -38,11 +674,13 @@ write_colorized_tile(const base_extract::simple_cut & cut, const long t_x,
     typedef gil::image_view<locator_t>              virt_view_t;
 
     point_t dim(TILE_DIMENSION_PIXELS, TILE_DIMENSION_PIXELS);
-    deref_t sampler(cut, t_x, t_y, t_z);
+    deref_t sampler(pyramid, t_x, t_y, t_z, sampling);
     virt_view_t view(dim, locator_t(point_t(0, 0), point_t(1, 1), sampler));
-    //gil::rgba8_image_t buf(view.dimensions());
-    //gil::copy_pixels(view, gil::view(buf));
-    gil::png_write_view(filename, view);
+
+    gil::rgba8_image_t buf(view.dimensions());
+    render_tile_view(view, buf, sampling.order, threads);
+    encode_png(gil::const_view(buf), png, options);
+
     return sampler.has_significant_data();
 }
 
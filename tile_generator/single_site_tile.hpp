@@ -2,6 +2,8 @@
 #define RSME_INCLUDED_SINGLE_SITE_TILE_HPP
 
 #include <map>
+#include <string>
+#include <vector>
 #include <utility>
 #include <boost/tuple/tuple.hpp>
 #include <boost/gil/utilities.hpp>
@@ -10,50 +12,98 @@
 #include <boost/gil/color_base_algorithm.hpp>
 #include <boost/gil/channel_algorithm.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/atomic.hpp>
 
 #include "geo_math.hpp"
 #include "tile_coord.hpp"
 #include "sample_cut.hpp"
+#include "polar_pyramid.hpp"
+#include "local_projection.hpp"
+#include "png_encoder.hpp"
 #include "../base_extract/simple_cut.hpp"
 
 namespace tile_generator {
 
 namespace gil = boost::gil;
 
+struct tile_sampler;
+
+/*
+ * What gets written for a tile. Colorized tiles are tone mapped for display,
+ * and data tiles carry the sampled values for the client to color itself.
+ */
+enum tile_format
+{
+    TILE_COLORIZED,
+    TILE_DATA
+};
+
+const char * tile_suffix(const tile_format format);
+std::string tile_output_path(const std::string & name, const long t_x,
+        const long t_y, const int t_z,
+        const tile_format format = TILE_COLORIZED);
+std::string tile_output_path(const base_extract::simple_cut & cut,
+        const long t_x, const long t_y, const int t_z,
+        const tile_format format = TILE_COLORIZED);
+std::string empty_tile_path(const std::string & name,
+        const tile_format format = TILE_COLORIZED);
+std::string empty_tile_path(const base_extract::simple_cut & cut,
+        const tile_format format = TILE_COLORIZED);
+void write_empty_tile(const char * filename,
+        const tile_format format = TILE_COLORIZED);
+void encode_empty_tile(std::vector<unsigned char> & png,
+        const tile_format format = TILE_COLORIZED);
+void link_empty_tile(const std::string & empty_path,
+        const std::string & filename);
 void write_green_tile(const base_extract::simple_cut & cut, const long t_x,
         const long t_y, const int t_z, const char * filename);
 bool write_colorized_tile(const base_extract::simple_cut & cut, const long t_x,
         const long t_y, const int t_z, const char * filename);
+bool write_colorized_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, const char * filename,
+        const unsigned int threads = 1);
+bool write_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, const char * filename,
+        const tile_format format, const unsigned int threads = 1,
+        const sampling_options & sampling = sampling_options());
+bool encode_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, std::vector<unsigned char> & png,
+        const tile_format format, const unsigned int threads = 1,
+        const sampling_options & sampling = sampling_options());
+bool encode_tile(const tile_sampler & sampler,
+        std::vector<unsigned char> & png, const tile_format format,
+        const unsigned int threads = 1);
+bool encode_colorized_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, std::vector<unsigned char> & png,
+        const unsigned int threads = 1,
+        const png_options & options = png_options(),
+        const sampling_options & sampling = sampling_options());
+bool encode_colorized_tile(const tile_sampler & sampler,
+        std::vector<unsigned char> & png, const unsigned int threads = 1,
+        const png_options & options = png_options());
+bool encode_colorized_tile_reference(const polar_pyramid & pyramid,
+        const long t_x, const long t_y, const int t_z,
+        std::vector<unsigned char> & png, const unsigned int threads = 1,
+        const png_options & options = png_options(),
+        const sampling_options & sampling = sampling_options());
 
 /*
  * Colorized tone mapping operator. The color table is static to the class, and
- * calculated color values are cached in the color table as an optimization.
+ * is filled in once, the first time an instance is constructed, in a way that
+ * is safe when tiles are being rendered from several threads.
+ *
+ * The table given by the control points below is expanded at that time into a
+ * dense lookup table with an entry for every 0.1 dBZ step it covers, so the
+ * per pixel cost is one indexed load and the alpha multiply. Each entry is
+ * interpolated exactly from the control points, so there is no accumulation
+ * of roundoff from interpolating between cached values.
  */
 template <typename PixelType>
 struct colorized_tmo
 {
     colorized_tmo()
-    {
-        /*
-         * The radar measured values are truncated at the first decimal place
-         * to increase cache usage.
-         */
-        if (!color_table_initialized)
-        {
-            color_table[-320] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x00);
-            color_table[   0] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x00);
-            color_table[ 100] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x7f);
-            color_table[ 250] = gil::rgba8_pixel_t(0x1a, 0xb7, 0x6a, 0xff);
-            color_table[ 350] = gil::rgba8_pixel_t(0x0b, 0x51, 0x0d, 0xff);
-            color_table[ 420] = gil::rgba8_pixel_t(0xdf, 0xca, 0x1a, 0xff);
-            color_table[ 500] = gil::rgba8_pixel_t(0xb8, 0x08, 0x10, 0xff);
-            color_table[ 550] = gil::rgba8_pixel_t(0x85, 0x09, 0x0a, 0xff);
-            color_table[ 620] = gil::rgba8_pixel_t(0xcb, 0x1c, 0xe5, 0xff);
-            color_table[ 700] = gil::rgba8_pixel_t(0x39, 0x9c, 0xcc, 0xff);
-            color_table[ 800] = gil::rgba8_pixel_t(0xff, 0xff, 0xff, 0xff);
-            color_table[1000] = gil::rgba8_pixel_t(0xff, 0xff, 0xff, 0xff);
-        }
-    }
+        { boost::call_once(color_table_once, &initialize_color_table); }
 
     /*
      * Public interface, returns the color corresponding to the radar value.
@@ -76,30 +126,67 @@ struct colorized_tmo
 
 private:
     /*
-     * Static storage of the color table, and a flag indicating its
-     * initialization status.
+     * Range of the table, in tenths of dBZ. Values outside it take the color
+     * at the nearer end.
+     */
+    static const int TABLE_MIN_Z_HAT = -320;
+    static const int TABLE_MAX_Z_HAT = 1000;
+    static const int DENSE_TABLE_SIZE = TABLE_MAX_Z_HAT - TABLE_MIN_Z_HAT + 1;
+
+    /*
+     * Static storage of the control points, the dense table built from them,
+     * and a flag indicating its initialization status.
      */
     typedef typename std::map<int, PixelType> color_table_t;
     static color_table_t color_table;
-    static bool color_table_initialized;
+    static PixelType dense_table[DENSE_TABLE_SIZE];
+    static boost::once_flag color_table_once;
 
     /*
-     * This is the meat of this TMO, it searches in the color table for a
-     * cached value, and returns it. If no cached value is found, it linearly
-     * interpolates the value from the nearest neighbors and caches it before
-     * returning.
-     *
-     * NOTE: The caching is currently disabled because certain patterns of
-     * access (particularly at high zoom levels) cause visually apparent
-     * accumulation of roundoff error, creating artifacts in the tone mapping
-     * and visible borders between the tiles. This actually doesn't turn out to
-     * cause a large performance hit.
+     * The radar measured values are truncated at the first decimal place,
+     * which is the resolution of the dense table.
      */
+    static void initialize_color_table(void)
+    {
+        color_table[-320] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x00);
+        color_table[   0] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x00);
+        color_table[ 100] = gil::rgba8_pixel_t(0x7a, 0x6c, 0x86, 0x7f);
+        color_table[ 250] = gil::rgba8_pixel_t(0x1a, 0xb7, 0x6a, 0xff);
+        color_table[ 350] = gil::rgba8_pixel_t(0x0b, 0x51, 0x0d, 0xff);
+        color_table[ 420] = gil::rgba8_pixel_t(0xdf, 0xca, 0x1a, 0xff);
+        color_table[ 500] = gil::rgba8_pixel_t(0xb8, 0x08, 0x10, 0xff);
+        color_table[ 550] = gil::rgba8_pixel_t(0x85, 0x09, 0x0a, 0xff);
+        color_table[ 620] = gil::rgba8_pixel_t(0xcb, 0x1c, 0xe5, 0xff);
+        color_table[ 700] = gil::rgba8_pixel_t(0x39, 0x9c, 0xcc, 0xff);
+        color_table[ 800] = gil::rgba8_pixel_t(0xff, 0xff, 0xff, 0xff);
+        color_table[1000] = gil::rgba8_pixel_t(0xff, 0xff, 0xff, 0xff);
+
+        for (int k = 0;
+                k != DENSE_TABLE_SIZE;
+                ++k)
+            dense_table[k] = interpolate(TABLE_MIN_Z_HAT + k);
+    }
+
     PixelType lookup(const float z) const
+    {
+        int z_hat = static_cast<int>(z * 10.0);
+        if (z_hat < TABLE_MIN_Z_HAT)
+            z_hat = TABLE_MIN_Z_HAT;
+        else if (z_hat > TABLE_MAX_Z_HAT)
+            z_hat = TABLE_MAX_Z_HAT;
+
+        return dense_table[z_hat - TABLE_MIN_Z_HAT];
+    }
+
+    /*
+     * Searches the control points for the given value, and linearly
+     * interpolates from the nearest neighbors if it isn't one of them. Only
+     * used to build the dense table.
+     */
+    static PixelType interpolate(const int z_hat)
     {
         using boost::tie;
 
-        const int z_hat = static_cast<int>(z * 10.0);
         typedef typename color_table_t::const_iterator ct_iterator;
 
         ct_iterator ct_iter = color_table.find(z_hat);
@@ -136,14 +223,17 @@ private:
 };
 
 /*
- * Static storage for color table and init flag.
+ * Static storage for color tables and init flag.
  */
 template <typename PixelType>
     typename colorized_tmo<PixelType>::color_table_t
     colorized_tmo<PixelType>::color_table;
 template <typename PixelType>
-    bool
-    colorized_tmo<PixelType>::color_table_initialized(false);
+    PixelType
+    colorized_tmo<PixelType>::dense_table[DENSE_TABLE_SIZE];
+template <typename PixelType>
+    boost::once_flag
+    colorized_tmo<PixelType>::color_table_once = BOOST_ONCE_INIT;
 
 /*
  * Extremely simplistic TMO, puts a scaled measurement value in the green
@@ -178,14 +268,69 @@ struct green_tmo
     }
 };
 
+/*
+ * How far apart the center and the first oversampling point of a pixel have
+ * to be, in measurement (dBZ) or validity, for the pixel to be oversampled.
+ */
+const float OVERSAMPLE_MIN_Z_STEP = 4.0;
+const float OVERSAMPLE_MIN_V_STEP = 0.25;
+
+/*
+ * Samples the radar value under any point of a tile, given in pixels from the
+ * tile origin, in the way the sampling options ask for. The filter width of
+ * the Gaussian is the north-south size of the pixel, which varies smoothly
+ * from row to row, across tile borders too, rather than from tile to tile,
+ * so neighbouring tiles meet without a seam. The cheaper modes
+ * sample the cut itself rather than a pyramid level, since they are meant
+ * for zoom levels where a pixel is smaller than a gate.
+ *
+ * Pixel centers take their latitude and longitude from a pixel grid, either
+ * the tile's own or one for a block of tiles the tile is in, which is shared
+ * between the samplers for all of them. With approximate projection, the
+ * centers of all the pixels are located up front, a row at a time, and
+ * shared between copies of the sampler.
+ */
+struct tile_sampler
+{
+    tile_sampler(const polar_pyramid & the_pyramid, const long tile_x,
+            const long tile_y, const int tile_z,
+            const sampling_options & the_sampling = sampling_options());
+    tile_sampler(const polar_pyramid & the_pyramid,
+            const boost::shared_ptr<const pixel_grid> & the_grid,
+            const long tile_x, const long tile_y,
+            const sampling_options & the_sampling = sampling_options());
+
+    radar_value_t operator()(const double d_x, const double d_y) const;
+    radar_value_t pixel(const int x, const int y) const;
+
+    const polar_pyramid & pyramid;
+    const long t_x, t_y;
+    const int t_z;
+    const sampling_options sampling;
+
+private:
+    void locate_centers(void);
+    radar_value_t sample_at(const polar_point & point,
+            const float filter_width_meters) const;
+
+    local_projection projection;
+    boost::shared_ptr<const pixel_grid> grid;
+    const double * row_lat;         // This tile's part of the grid
+    const double * column_lon;
+    const float * row_height;
+    boost::shared_ptr<const projected_tile> centers;
+};
+
 /*
  * Implements a virtual image_view concept that generates a tile at specified
- * tile coordinates from the given simple_cut. Uses the tone mapping operator
- * specified to convert radar measurements to colors.
+ * tile coordinates from the given cut's pyramid. Uses the tone mapping
+ * operator specified to convert radar measurements to colors.
  *
  * The shared pointer thing is because the constructor in GIL's virtual image
  * view constructor (and evidently a number of other parts of the code where
  * this is used) aggravatingly passes by value instead of const reference.
+ * The flag is atomic because the copies may be sampling different parts of
+ * the tile on different threads.
  */
 template <typename PixelType, typename Tmo>
 struct sampled_cut
@@ -199,86 +344,34 @@ struct sampled_cut
     typedef reference              result_type;
     BOOST_STATIC_CONSTANT(bool, is_mutable=false);
 
-    sampled_cut(const base_extract::simple_cut & the_cut, const long tile_x,
-            const long tile_y, const int tile_z)
-        : cut(the_cut), t_x(tile_x), t_y(tile_y), t_z(tile_z),
-            filter_width_meters(calculate_filter_width(tile_y, tile_z)),
-            significance_threshold_met(new bool(false)) { }
+    sampled_cut(const polar_pyramid & the_pyramid, const long tile_x,
+            const long tile_y, const int tile_z,
+            const sampling_options & the_sampling = sampling_options())
+        : sampler(the_pyramid, tile_x, tile_y, tile_z, the_sampling),
+            significance_threshold_met(new boost::atomic<bool>(false)) { }
 
     result_type operator()(const point_t & p) const
-        { return sample_tone_mapped(p, 0.5, 0.5); }
-
-    bool has_significant_data(void) const
-        { return *significance_threshold_met; }
-
-private:
-    sampled_cut() { }
-    const base_extract::simple_cut & cut;
-    const long t_x, t_y;
-    const int t_z;
-    const float filter_width_meters;
-    boost::shared_ptr<bool> significance_threshold_met;
-    Tmo tmo;
-
-    result_type sample_tone_mapped(const point_t & p, const float d_x,
-            const float d_y) const
     {
-        using boost::tie;
-
-        double lat, lon;
-        tie(lat, lon) = pixel_mercator_to_latlon(t_x, t_y,
-                p.x + d_x, p.y + d_y, t_z);
+        PixelType ret = tmo(sampler.pixel(p.x, p.y));
 
-        const radar_value_t rv =
-            sample_gaussian(cut, lat, lon, filter_width_meters);
-        PixelType ret = tmo(rv);
-
-        if (gil::semantic_at_c<3>(ret) > 0)
-            *significance_threshold_met = true;
+        // Check before storing so threads aren't all fighting over the cache
+        // line once the flag is set.
+        boost::atomic<bool> & flag = *significance_threshold_met;
+        if (gil::semantic_at_c<3>(ret) > 0
+                && !flag.load(boost::memory_order_relaxed))
+            flag.store(true, boost::memory_order_relaxed);
 
         return ret;
     }
 
-    static float calculate_filter_width(const long t_y, const int t_z)
-    {
-        using boost::get;
-
-        const float delta_lat =
-            get<0>(pixel_mercator_to_latlon(0, t_y, 0.0, 0.0, t_z)) -
-            get<0>(pixel_mercator_to_latlon(0, t_y, 0.0, 1.0, t_z));
-        return MEAN_EARTH_RADIUS * delta_lat;
-    }
-
-    result_type oversample_gauss_5pt(const point_t & p) const
-    {
-        /*
-         * This is a 5-point gaussian-weighted oversampler.
-         */
-        result_type out, center;
-        result_type res[4];
-
-        // counter-clockwise from left, rotated counter-clockwise 22.5 degrees.
-        res[0] = sample_tone_mapped(p,  1.4239,  0.1173);
-        res[1] = sample_tone_mapped(p,  0.1173, -0.4239);
-        res[2] = sample_tone_mapped(p, -0.4239,  0.8827);
-        res[3] = sample_tone_mapped(p,  0.8827,  1.4239);
-        center = sample_tone_mapped(p, 0.5, 0.5);
-
-        for (int k = 0;
-                k < gil::num_channels<result_type>::value;
-                ++k)
-        {
-            out[k] =
-                static_cast<unsigned char>(
-                    res[0][k] * 0.125 +
-                    res[1][k] * 0.125 +
-                    res[2][k] * 0.125 +
-                    res[3][k] * 0.125 +
-                    center[k] * 0.500);
-        }
+    bool has_significant_data(void) const
+        { return significance_threshold_met->load(); }
 
-        return out;
-    }
+private:
+    sampled_cut() { }
+    tile_sampler sampler;
+    boost::shared_ptr< boost::atomic<bool> > significance_threshold_met;
+    Tmo tmo;
 };
 
 } // namespace tile_generator
@@ -0,0 +1,156 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <exception>
+#include <sys/stat.h>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "site_cache.hpp"
+#include "work_stealing_pool.hpp"
+
+namespace tile_generator {
+
+simple_cut
+read_cut(const std::string & path)
+{
+    simple_cut cut;
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    boost::archive::binary_iarchive ia(ifs);
+    ia >> cut;
+    return cut;
+}
+
+loaded_site::loaded_site(const std::string & base_path,
+        const std::time_t the_mtime)
+    : mtime(the_mtime), cut(read_cut(base_path)), pyramid(cut),
+        coverage(cut) { }
+
+typedef work_stealing_pool<size_t> load_pool_t;
+
+/*
+ * Loads one site for load_sites(). Each task writes only its own element of
+ * the already sized result, so the workers need no lock.
+ */
+struct load_task
+{
+    load_task(const std::vector<std::string> & the_paths,
+            loaded_sites_t & the_sites)
+        : paths(the_paths), sites(the_sites) { }
+
+    void operator()(const size_t & i, load_pool_t::worker & w) const
+    {
+        try
+        {
+            sites[i].reset(new loaded_site(paths[i], 0));
+        }
+        catch (std::exception & e)
+        {
+            std::cerr << paths[i] << ": " << e.what() << std::endl;
+        }
+    }
+
+    const std::vector<std::string> & paths;
+    loaded_sites_t & sites;
+};
+
+/*
+ * Load a site from each of the base files given, on a pool of threads, since
+ * building the pyramids takes a while. A base file that can't be read is
+ * reported on stderr and its site left null. A thread count of zero uses one
+ * thread per hardware thread.
+ */
+void
+load_sites(const std::vector<std::string> & paths, loaded_sites_t & sites,
+        const size_t thread_count)
+{
+    const size_t n = (thread_count > 0
+            ? thread_count
+            : boost::thread::hardware_concurrency());
+
+    sites.assign(paths.size(), boost::shared_ptr<const loaded_site>());
+
+    load_pool_t pool(n);
+    for (size_t i = 0;
+            i != paths.size();
+            ++i)
+        pool.push(i);
+    pool.run(load_task(paths, sites));
+}
+
+site_cache::site_cache(const std::string & the_base_dir)
+    : base_dir(the_base_dir) { }
+
+boost::shared_ptr<const loaded_site>
+site_cache::get(const std::string & site)
+{
+    const std::string path = base_dir + "/" + site + ".base";
+
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        boost::lock_guard<boost::mutex> lock(sites_mutex);
+        sites.erase(site);
+        return boost::shared_ptr<const loaded_site>();
+    }
+
+    // Claim the load, unless another thread already has. A site with a copy
+    // in memory keeps being served from it meanwhile; one without has
+    // nothing to serve, so waits for the load and looks again.
+    boost::shared_ptr<const loaded_site> current;
+    {
+        boost::unique_lock<boost::mutex> lock(sites_mutex);
+        for (;;)
+        {
+            sites_type::const_iterator iter = sites.find(site);
+            current = (iter == sites.end()
+                    ? boost::shared_ptr<const loaded_site>()
+                    : iter->second);
+            if (current && current->mtime == st.st_mtime)
+                return current;
+            if (loading.count(site) == 0)
+                break;
+            if (current)
+                return current;
+            site_loaded.wait(lock);
+        }
+        loading.insert(site);
+    }
+
+    boost::shared_ptr<const loaded_site> fresh;
+    try
+    {
+        fresh.reset(new loaded_site(path, st.st_mtime));
+    }
+    catch (std::exception & e)
+    {
+        finish_loading(site, fresh);
+        if (current)
+            return current;
+        throw;
+    }
+
+    finish_loading(site, fresh);
+    return fresh;
+}
+
+/*
+ * Store the site just loaded, if it could be, and let any threads waiting
+ * on it look again.
+ */
+void
+site_cache::finish_loading(const std::string & site,
+        const boost::shared_ptr<const loaded_site> & fresh)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(sites_mutex);
+        if (fresh)
+            sites[site] = fresh;
+        loading.erase(site);
+    }
+    site_loaded.notify_all();
+}
+
+} // namespace tile_generator
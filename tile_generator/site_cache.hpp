@@ -0,0 +1,85 @@
+#ifndef RSME_INCLUDED_SITE_CACHE_HPP
+#define RSME_INCLUDED_SITE_CACHE_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "polar_pyramid.hpp"
+#include "coverage.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+using base_extract::simple_cut;
+
+/*
+ * Read a cut from a base file written by the extractor.
+ */
+simple_cut read_cut(const std::string & path);
+
+/*
+ * Everything kept in memory for one site: the cut from its base file, and the
+ * pyramid and coverage summary built over it. The pyramid refers into the
+ * cut, so this is never copied.
+ */
+struct loaded_site : boost::noncopyable
+{
+    loaded_site(const std::string & base_path, const std::time_t the_mtime);
+
+    const std::time_t mtime;
+    const simple_cut cut;
+    const polar_pyramid pyramid;
+    const coverage_summary coverage;
+};
+
+typedef std::vector< boost::shared_ptr<const loaded_site> > loaded_sites_t;
+
+void load_sites(const std::vector<std::string> & paths,
+        loaded_sites_t & sites, const size_t thread_count);
+
+/*
+ * The current cut for every site that has been asked for, loaded from
+ * BASEDIR/SITE.base. Each lookup checks the base file's modification time
+ * and reloads the site if it has changed, so a long running server picks up
+ * new scans as the extractor writes them. Lookups are safe from several
+ * threads at once. A site being reloaded is only loaded once, by the first
+ * thread to find it changed, and doesn't hold up lookups of any other site;
+ * while it loads, lookups of it are answered with the copy already in memory.
+ */
+class site_cache : boost::noncopyable
+{
+public:
+    explicit site_cache(const std::string & the_base_dir);
+
+    /*
+     * Returns a null pointer if the site has no base file. If the base file
+     * can't be read (say it's half written) and an older copy of the site is
+     * loaded, the older copy is returned.
+     */
+    boost::shared_ptr<const loaded_site> get(const std::string & site);
+
+private:
+    typedef std::map< std::string, boost::shared_ptr<const loaded_site> >
+        sites_type;
+
+    const std::string base_dir;
+
+    boost::mutex                sites_mutex;
+    boost::condition_variable   site_loaded;
+    sites_type                  sites;
+    std::set<std::string>       loading;
+
+    void finish_loading(const std::string & site,
+            const boost::shared_ptr<const loaded_site> & fresh);
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_SITE_CACHE_HPP
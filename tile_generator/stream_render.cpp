@@ -0,0 +1,186 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "../reader/archive_reader.hpp"
+#include "../reader/rda_message.hpp"
+#include "../reader/radial_generic_format.hpp"
+#include "../base_extract/simple_cut.hpp"
+#include "progressive_render.hpp"
+#include "tile_output.hpp"
+#include "sampling_policy.hpp"
+
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using boost::format;
+    using namespace archive2;
+    using namespace base_extract;
+    using namespace tile_generator;
+    cout.sync_with_stdio(false);
+
+    // Optional leading --threads N (the default is a thread per core),
+    // --data, to write data tiles instead of colorized ones, and --sampling
+    // POLICY, as for generate.
+    unsigned int threads = 0;
+    tile_format output_format = TILE_COLORIZED;
+    sampling_policy sampling;
+    for (;;)
+    {
+        if (argc > 2 && std::string(argv[1]) == "--threads")
+        {
+            try
+            {
+                threads = boost::lexical_cast<unsigned int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad thread count" << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 1 && std::string(argv[1]) == "--data")
+        {
+            output_format = TILE_DATA;
+            argc -= 1;
+            argv += 1;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--sampling")
+        {
+            try
+            {
+                sampling = sampling_policy(argv[2]);
+            }
+            catch (sampling_policy_error & e)
+            {
+                cout << e.what() << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else
+            break;
+    }
+
+    if (argc != 3 && argc != 4)
+    {
+        cout
+            << "usage: stream-render [--threads N] [--data] "
+               "[--sampling <zoom>:<mode>[,...]]\n"
+               "                     <startzoom> <endzoom> [basefile]\n"
+               "Renders the first cut of a Level II archive on stdin, or "
+               "replays the radials\nof a base file in the order they were "
+               "taken."
+            << std::endl;
+        return 1;
+    }
+
+    int start_zoom, end_zoom;
+    try
+    {
+        start_zoom = boost::lexical_cast<int>(argv[1]);
+        end_zoom = boost::lexical_cast<int>(argv[2]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad zoomlevel" << std::endl;
+        return 1;
+    }
+
+    // The output and renderer can only be set up once the site is known,
+    // which for an archive is at its first radial.
+    std::auto_ptr<tile_output> output;
+    std::auto_ptr<progressive_renderer> renderer;
+
+    if (argc == 4)
+    {
+        simple_cut base;
+        {
+            std::ifstream ifs(argv[3], std::ios::binary);
+            boost::archive::binary_iarchive ia(ifs);
+            ia >> base;
+        }
+
+        simple_cut header;
+        header.radar_identifier = base.radar_identifier;
+        header.latitude = base.latitude;
+        header.longitude = base.longitude;
+        header.geo_elevation = base.geo_elevation;
+        header.vcp_nr = base.vcp_nr;
+        header.start_timestamp = base.start_timestamp;
+        header.end_timestamp = base.end_timestamp;
+
+        std::map<unsigned int, simple_radial> taken;
+        simple_cut::radials_type::const_iterator iter;
+        for (iter = base.radials.begin();
+                iter != base.radials.end();
+                ++iter)
+            taken[iter->second.azimuth_nr] = iter->second;
+
+        output.reset(new tile_output(header, output_format));
+        output->set_sampling(sampling);
+        renderer.reset(new progressive_renderer(header, start_zoom,
+                    end_zoom, threads, *output));
+
+        std::map<unsigned int, simple_radial>::const_iterator taken_iter;
+        for (taken_iter = taken.begin();
+                taken_iter != taken.end();
+                ++taken_iter)
+            renderer->push(taken_iter->second);
+    }
+    else
+    {
+        // Each radial goes to the renderer as soon as the block it came in
+        // is decoded, while the rest of the cut is still arriving.
+        archive_message_reader reader(std::cin);
+        rda_message msg;
+        while (reader.next(msg))
+        {
+            try
+            {
+                const radial_generic_format radial(msg);
+
+                if (radial.radial_status ==
+                        radial_generic_format::STATUS_START_OF_VOLUME)
+                {
+                    const simple_cut header(radial);
+                    output.reset(new tile_output(header, output_format));
+                    output->set_sampling(sampling);
+                    renderer.reset(new progressive_renderer(header,
+                                start_zoom, end_zoom, threads, *output));
+                }
+
+                if (radial.radial_status ==
+                        radial_generic_format::STATUS_START_OF_ELEVATION)
+                    break;
+
+                if (renderer.get())
+                    renderer->push(simple_radial(radial));
+            }
+            catch (rda_message::wrong_type & e)
+                { }
+        }
+
+        if (!renderer.get())
+        {
+            cout << "no volume on stdin" << std::endl;
+            return 1;
+        }
+    }
+
+    renderer->finish();
+
+    cout << format("%1% tiles rendered before the cut was complete, %2% "
+            "after\n")
+        % renderer->early_count() % renderer->late_count() << std::flush;
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <map>
+#include <list>
+#include <string>
+#include <boost/thread/locks.hpp>
+
+#include "tile_cache.hpp"
+
+namespace tile_generator {
+
+/*
+ * Rough bookkeeping cost of a cached tile on top of its encoded bytes: the map
+ * node, the LRU list node with its copy of the key, and the tile's vector and
+ * reference count.
+ */
+const size_t ENTRY_OVERHEAD_BYTES = 256;
+
+bool
+tile_key::operator<(const tile_key & rhs) const
+{
+    // Site first, so all of a site's tiles sit together in the map.
+    if (site != rhs.site) return site < rhs.site;
+    if (volume != rhs.volume) return volume < rhs.volume;
+    if (z != rhs.z) return z < rhs.z;
+    if (x != rhs.x) return x < rhs.x;
+    if (y != rhs.y) return y < rhs.y;
+    return format < rhs.format;
+}
+
+size_t
+entry_bytes(const tile_cache::tile_ptr & tile)
+{
+    return tile->size() + ENTRY_OVERHEAD_BYTES;
+}
+
+tile_cache::tile_cache(const size_t the_byte_budget)
+    : byte_budget(the_byte_budget), bytes(0) { }
+
+tile_cache::tile_ptr
+tile_cache::get(const tile_key & key, const render_function & render,
+        bool & hit)
+{
+    boost::shared_ptr<flight> our_flight;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        retire_volumes_locked(key.site, key.volume);
+
+        for (;;)
+        {
+            tiles_type::iterator iter = tiles.find(key);
+            if (iter != tiles.end())
+            {
+                lru.splice(lru.begin(), lru, iter->second.lru_pos);
+                hit = true;
+                return iter->second.tile;
+            }
+
+            in_flight_type::iterator flight_iter = in_flight.find(key);
+            if (flight_iter == in_flight.end())
+                break;
+
+            // Someone else is rendering it, so wait for theirs. If their
+            // render failed, go round again and have a go ourselves.
+            const boost::shared_ptr<flight> their_flight = flight_iter->second;
+            while (!their_flight->done)
+                render_done.wait(lock);
+            if (their_flight->tile)
+            {
+                hit = true;
+                return their_flight->tile;
+            }
+        }
+
+        our_flight.reset(new flight);
+        in_flight.insert(std::make_pair(key, our_flight));
+    }
+
+    hit = false;
+    boost::shared_ptr<tile_data> tile(new tile_data);
+    try
+    {
+        render(*tile);
+    }
+    catch (...)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            our_flight->done = true;
+            in_flight.erase(key);
+        }
+        render_done.notify_all();
+        throw;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        our_flight->tile = tile;
+        our_flight->done = true;
+        in_flight.erase(key);
+        insert_locked(key, tile);
+    }
+    render_done.notify_all();
+
+    return tile;
+}
+
+void
+tile_cache::retire_volumes(const std::string & site, const bt::ptime & volume)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    retire_volumes_locked(site, volume);
+}
+
+size_t
+tile_cache::size_bytes(void)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return bytes;
+}
+
+size_t
+tile_cache::tile_count(void)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return tiles.size();
+}
+
+void
+tile_cache::retire_volumes_locked(const std::string & site,
+        const bt::ptime & volume)
+{
+    volumes_type::iterator vol_iter = volumes.find(site);
+    if (vol_iter == volumes.end())
+    {
+        volumes.insert(std::make_pair(site, volume));
+        return;
+    }
+    if (!(vol_iter->second < volume))
+        return;
+    vol_iter->second = volume;
+
+    tiles_type::iterator iter = tiles.lower_bound(
+            tile_key(site, bt::ptime(bt::neg_infin), 0, 0, 0,
+                TILE_COLORIZED));
+    while (iter != tiles.end()
+            && iter->first.site == site
+            && iter->first.volume < volume)
+        erase_locked(iter++);
+}
+
+void
+tile_cache::insert_locked(const tile_key & key, const tile_ptr & tile)
+{
+    // Don't keep a tile that was overtaken by a newer volume while it was
+    // being rendered, or one that would take the whole budget by itself.
+    const volumes_type::const_iterator vol_iter = volumes.find(key.site);
+    if (vol_iter != volumes.end() && key.volume < vol_iter->second)
+        return;
+    const size_t size = entry_bytes(tile);
+    if (size > byte_budget)
+        return;
+
+    while (bytes + size > byte_budget)
+        erase_locked(tiles.find(lru.back()));
+
+    lru.push_front(key);
+    entry e;
+    e.tile = tile;
+    e.lru_pos = lru.begin();
+    tiles.insert(std::make_pair(key, e));
+    bytes += size;
+}
+
+void
+tile_cache::erase_locked(tiles_type::iterator iter)
+{
+    bytes -= entry_bytes(iter->second.tile);
+    lru.erase(iter->second.lru_pos);
+    tiles.erase(iter);
+}
+
+} // namespace tile_generator
@@ -0,0 +1,130 @@
+#ifndef RSME_INCLUDED_TILE_CACHE_HPP
+#define RSME_INCLUDED_TILE_CACHE_HPP
+
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "single_site_tile.hpp"
+
+namespace tile_generator {
+
+namespace bt = boost::posix_time;
+
+/*
+ * Default byte budget for the tile cache, 256 megabytes.
+ */
+const size_t TILE_CACHE_DEFAULT_BYTES = 256 * 1024 * 1024;
+
+/*
+ * Identifies one rendered tile. The volume is the start time of the cut the
+ * tile was rendered from, so tiles from an older volume never match a request
+ * against a newer one.
+ */
+struct tile_key
+{
+    tile_key(const std::string & the_site, const bt::ptime & the_volume,
+            const long the_x, const long the_y, const int the_z,
+            const tile_format the_format)
+        : site(the_site), volume(the_volume), x(the_x), y(the_y), z(the_z),
+            format(the_format) { }
+
+    std::string site;
+    bt::ptime   volume;
+    long        x, y;
+    int         z;
+    tile_format format;
+
+    bool operator<(const tile_key & rhs) const;
+};
+
+/*
+ * Encoded tiles kept in memory, up to a byte budget, with the least recently
+ * used ones evicted first.
+ *
+ * When a tile isn't in the cache, the first thread to ask for it renders it
+ * and any other thread asking for it meanwhile waits for that render instead
+ * of starting its own.
+ *
+ * Only tiles from the newest volume seen for each site are kept. Asking for a
+ * tile from a newer volume throws away everything cached for the site, and a
+ * render for an older volume that finishes after that isn't kept.
+ */
+class tile_cache : boost::noncopyable
+{
+public:
+    typedef std::vector<unsigned char> tile_data;
+    typedef boost::shared_ptr<const tile_data> tile_ptr;
+    typedef boost::function<void (tile_data &)> render_function;
+
+    explicit tile_cache(const size_t the_byte_budget =
+            TILE_CACHE_DEFAULT_BYTES);
+
+    /*
+     * Returns the tile, rendering it with the function given if it isn't
+     * cached. Sets hit to say whether it was already cached, or already being
+     * rendered by another thread. If the render throws, the exception goes to
+     * the thread that ran it and the waiting threads try again themselves.
+     */
+    tile_ptr get(const tile_key & key, const render_function & render,
+            bool & hit);
+
+    /*
+     * Note the newest volume for a site, dropping every tile cached for it
+     * from an older one. get() does this itself for the volume asked for.
+     */
+    void retire_volumes(const std::string & site, const bt::ptime & volume);
+
+    size_t size_bytes(void);
+    size_t tile_count(void);
+
+private:
+    typedef std::list<tile_key> lru_type;
+
+    struct entry
+    {
+        tile_ptr           tile;
+        lru_type::iterator lru_pos;
+    };
+
+    // A render in progress, which other threads asking for the same tile
+    // wait on. The tile is left null if the render failed.
+    struct flight
+    {
+        flight() : done(false) { }
+
+        bool     done;
+        tile_ptr tile;
+    };
+
+    typedef std::map<tile_key, entry> tiles_type;
+    typedef std::map< tile_key, boost::shared_ptr<flight> > in_flight_type;
+    typedef std::map<std::string, bt::ptime> volumes_type;
+
+    const size_t byte_budget;
+
+    boost::mutex              mutex;
+    boost::condition_variable render_done;
+    tiles_type                tiles;
+    lru_type                  lru;  // most recently used at the front
+    in_flight_type            in_flight;
+    volumes_type              volumes;
+    size_t                    bytes;
+
+    // These expect the mutex to be held.
+    void retire_volumes_locked(const std::string & site,
+            const bt::ptime & volume);
+    void insert_locked(const tile_key & key, const tile_ptr & tile);
+    void erase_locked(tiles_type::iterator iter);
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_TILE_CACHE_HPP
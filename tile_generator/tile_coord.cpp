@@ -138,4 +138,44 @@ pixel_mercator_to_latlon(const long t_x, const long t_y, const double dt_x,
     return double_pair_t(lat, lon);
 }
 
+/*
+ * The north-south size on the ground, in meters, of the pixels whose top
+ * edge is dt_y pixels down from the top of the tiles in row t_y. In Mercator
+ * it shrinks with the cosine of the latitude, so it changes from one row of
+ * pixels to the next.
+ */
+float
+pixel_height_meters(const long t_y, const double dt_y, const int zoom_level)
+{
+    using boost::get;
+
+    const double delta_lat =
+        get<0>(pixel_mercator_to_latlon(0, t_y, 0.0, dt_y, zoom_level)) -
+        get<0>(pixel_mercator_to_latlon(0, t_y, 0.0, dt_y + 1.0, zoom_level));
+    return MEAN_EARTH_RADIUS * delta_lat;
+}
+
+pixel_grid::pixel_grid(const long tile_x, const long tile_y, const int tile_z,
+        const int tiles_wide, const int tiles_high)
+    : t_x(tile_x), t_y(tile_y), t_z(tile_z),
+        lat(tiles_high * TILE_DIMENSION_PIXELS),
+        lon(tiles_wide * TILE_DIMENSION_PIXELS),
+        row_height_meters(tiles_high * TILE_DIMENSION_PIXELS)
+{
+    using boost::get;
+
+    for (size_t y = 0;
+            y != lat.size();
+            ++y)
+    {
+        lat[y] = get<0>(pixel_mercator_to_latlon(t_x, t_y, 0.5, y + 0.5, t_z));
+        row_height_meters[y] = pixel_height_meters(t_y, y, t_z);
+    }
+
+    for (size_t x = 0;
+            x != lon.size();
+            ++x)
+        lon[x] = get<1>(pixel_mercator_to_latlon(t_x, t_y, x + 0.5, 0.5, t_z));
+}
+
 } // namespace tile_generator
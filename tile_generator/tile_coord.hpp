@@ -1,6 +1,7 @@
 #ifndef RSME_INCLUDED_TILE_COORD_HPP
 #define RSME_INCLUDED_TILE_COORD_HPP
 
+#include <vector>
 #include <boost/tuple/tuple.hpp>
 
 namespace tile_generator {
@@ -20,6 +21,61 @@ tile_coord_t latlon_to_pixel_mercator(const double lat_deg,
         const double lon_deg, const int zoom_level);
 double_pair_t pixel_mercator_to_latlon(const long t_x, const long t_y,
         const double dt_x, const double dt_y, const int zoom_level);
+float pixel_height_meters(const long t_y, const double dt_y,
+        const int zoom_level);
+
+/*
+ * The latitude of every row and the longitude of every column of pixel
+ * centers across a block of tiles, in radians. All the pixels in a row of
+ * the block share a latitude, and all those in a column a longitude, so
+ * with these worked out once for the block there is no inverse projection
+ * left to do per pixel, or per tile inside it. They come out exactly as
+ * pixel_mercator_to_latlon() gives them for each pixel. The height of each
+ * row is there too, for the filter width, which likewise comes out the same
+ * whichever block the row is worked out for.
+ */
+struct pixel_grid
+{
+    pixel_grid(const long tile_x, const long tile_y, const int tile_z,
+            const int tiles_wide = 1, const int tiles_high = 1);
+
+    // The tile at the upper left of the block.
+    const long t_x, t_y;
+    const int t_z;
+
+    std::vector<double> lat, lon;
+    std::vector<float> row_height_meters;
+};
+
+/*
+ * Gather the even bits of v into the low half.
+ */
+inline
+unsigned int
+compact_even_bits(unsigned int v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0f0f0f0f;
+    v = (v | (v >> 4)) & 0x00ff00ff;
+    v = (v | (v >> 8)) & 0x0000ffff;
+    return v;
+}
+
+/*
+ * The pixel at a position along the Z-order (Morton) curve through a square
+ * whose side is a power of two. The bits of the position alternate between
+ * x and y, so the curve fills each 2x2 block before moving on, then each
+ * 4x4, and so on up, and the first n * n pixels of it make up an n * n
+ * square, for any power of two n.
+ */
+inline
+void
+z_order_pixel(const unsigned int i, int & x, int & y)
+{
+    x = compact_even_bits(i);
+    y = compact_even_bits(i >> 1);
+}
 
 } // namespace tile_generator
 
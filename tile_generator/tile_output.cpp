@@ -0,0 +1,191 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#include <boost/lexical_cast.hpp>
+
+#include "tile_output.hpp"
+
+namespace tile_generator {
+
+tile_output::tile_output(const base_extract::simple_cut & the_cut,
+        const tile_format the_format)
+    : format(the_format), name_prefix(the_cut.radar_identifier), store(0),
+        previous(0), empty_path(empty_tile_path(name_prefix, the_format)),
+        rendered(0), identical(0), kept(0)
+{
+    write_empty_tile(empty_path.c_str(), format);
+}
+
+tile_output::tile_output(const std::string & the_name,
+        const tile_format the_format)
+    : format(the_format), name_prefix(the_name), store(0), previous(0),
+        empty_path(empty_tile_path(name_prefix, the_format)),
+        rendered(0), identical(0), kept(0)
+{
+    write_empty_tile(empty_path.c_str(), format);
+}
+
+tile_output::tile_output(const base_extract::simple_cut & the_cut,
+        const tile_format the_format, tile_store_writer & the_store,
+        const tile_store_reader * the_previous)
+    : format(the_format), name_prefix(the_cut.radar_identifier),
+        store(&the_store), previous(the_previous),
+        rendered(0), identical(0), kept(0)
+{
+    encode_empty_tile(empty_png, format);
+}
+
+bool
+tile_output::render(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z) const
+{
+    std::vector<unsigned char> png;
+    const bool significant = encode_tile(pyramid, t_x, t_y, t_z, png, format,
+            1, sampling(t_z));
+    put(t_x, t_y, t_z, png);
+    return significant;
+}
+
+/*
+ * The sampler's own sampling options are used, rather than the policy's.
+ */
+bool
+tile_output::render(const tile_sampler & sampler) const
+{
+    std::vector<unsigned char> png;
+    const bool significant = encode_tile(sampler, png, format);
+    put(sampler.t_x, sampler.t_y, sampler.t_z, png);
+    return significant;
+}
+
+bool
+tile_output::put_value_tile(const value_tile & tile, const long t_x,
+        const long t_y, const int t_z) const
+{
+    std::vector<unsigned char> png;
+    const bool significant = (format == TILE_DATA
+            ? encode_data_tile(tile, png)
+            : encode_colorized_value_tile(tile, png));
+    put(t_x, t_y, t_z, png);
+    return significant;
+}
+
+/*
+ * Whether two paths name the same file, as a tile linked to the shared empty
+ * tile does.
+ */
+bool
+same_file(const std::string & path, const std::string & other_path)
+{
+    struct stat st, other_st;
+    return ::stat(path.c_str(), &st) == 0
+        && ::stat(other_path.c_str(), &other_st) == 0
+        && st.st_dev == other_st.st_dev && st.st_ino == other_st.st_ino;
+}
+
+/*
+ * Whether the file at path already holds exactly the given tile.
+ */
+bool
+same_contents(const std::string & path,
+        const std::vector<unsigned char> & png)
+{
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    if (!ifs)
+        return false;
+
+    const std::vector<unsigned char> contents(
+            (std::istreambuf_iterator<char>(ifs)),
+            std::istreambuf_iterator<char>());
+    return contents == png;
+}
+
+void
+tile_output::put_empty(const long t_x, const long t_y, const int t_z) const
+{
+    ++rendered;
+    if (store)
+        store->add(t_x, t_y, t_z, empty_png);
+    else
+    {
+        const std::string path =
+            tile_output_path(name_prefix, t_x, t_y, t_z, format);
+        if (same_file(path, empty_path))
+            ++identical;
+        else
+            link_empty_tile(empty_path, path);
+    }
+}
+
+bool
+tile_output::has_previous(const long t_x, const long t_y,
+        const int t_z) const
+{
+    if (store)
+    {
+        const unsigned char * data;
+        size_t length;
+        return previous && previous->find(t_x, t_y, t_z, data, length);
+    }
+    else
+    {
+        struct stat st;
+        return ::stat(tile_output_path(name_prefix, t_x, t_y, t_z,
+                    format).c_str(), &st) == 0;
+    }
+}
+
+/*
+ * Keep the previous volume's tile, which has_previous() must have found.
+ * A tile file is simply left where it is.
+ */
+void
+tile_output::keep(const long t_x, const long t_y, const int t_z) const
+{
+    ++kept;
+    const unsigned char * data;
+    size_t length;
+    if (store && previous && previous->find(t_x, t_y, t_z, data, length))
+        store->add(t_x, t_y, t_z,
+                std::vector<unsigned char>(data, data + length));
+}
+
+std::string
+tile_output::name(const long t_x, const long t_y, const int t_z) const
+{
+    using boost::lexical_cast;
+    using std::string;
+
+    if (store)
+        return store->filename() + ":"
+            + lexical_cast<string>(t_z) + "/"
+            + lexical_cast<string>(t_x) + "/"
+            + lexical_cast<string>(t_y);
+    else
+        return tile_output_path(name_prefix, t_x, t_y, t_z, format);
+}
+
+void
+tile_output::put(const long t_x, const long t_y, const int t_z,
+        const std::vector<unsigned char> & png) const
+{
+    ++rendered;
+    if (store)
+        store->add(t_x, t_y, t_z, png);
+    else
+    {
+        const std::string path =
+            tile_output_path(name_prefix, t_x, t_y, t_z, format);
+        if (same_contents(path, png))
+        {
+            ++identical;
+            return;
+        }
+
+        write_png_buffer(png, path.c_str());
+    }
+}
+
+} // namespace tile_generator
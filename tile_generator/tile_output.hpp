@@ -0,0 +1,94 @@
+#ifndef RSME_INCLUDED_TILE_OUTPUT_HPP
+#define RSME_INCLUDED_TILE_OUTPUT_HPP
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/atomic.hpp>
+
+#include "single_site_tile.hpp"
+#include "value_tile.hpp"
+#include "polar_pyramid.hpp"
+#include "tile_store.hpp"
+#include "sampling_policy.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+/*
+ * Where generate sends the tiles it renders: either a file per tile under
+ * out/, with every empty tile linked to one shared file, or a tile store.
+ * Either way, tiles may be put from several threads at once.
+ *
+ * When re-rendering only what changed since the previous volume, a tile can
+ * also be kept as it was: left in place under out/, or copied over from the
+ * previous volume's store. Tile files that render the same as before are
+ * left alone rather than rewritten. The output counts what it did with each
+ * tile, for reporting at the end.
+ *
+ * Tiles are sampled as the output's sampling policy says for their zoom
+ * level, which is the Gaussian everywhere unless another policy is set
+ * before rendering starts.
+ */
+class tile_output : boost::noncopyable
+{
+public:
+    // One file per tile, named for the cut's site or for the name given.
+    // This writes the shared empty tile straight away.
+    tile_output(const base_extract::simple_cut & the_cut,
+            const tile_format the_format);
+    tile_output(const std::string & the_name, const tile_format the_format);
+    // Everything goes into the store, which the caller finishes. Tiles kept
+    // from the previous volume come out of its store, if one is given.
+    tile_output(const base_extract::simple_cut & the_cut,
+            const tile_format the_format, tile_store_writer & the_store,
+            const tile_store_reader * the_previous = 0);
+
+    /*
+     * Render a tile, or put one already sampled, returning whether it has
+     * any significant pixels.
+     */
+    bool render(const polar_pyramid & pyramid, const long t_x,
+            const long t_y, const int t_z) const;
+    bool render(const tile_sampler & sampler) const;
+    bool put_value_tile(const value_tile & tile, const long t_x,
+            const long t_y, const int t_z) const;
+    void put_empty(const long t_x, const long t_y, const int t_z) const;
+
+    // Whether there is a tile from the previous volume to keep, and keep it.
+    bool has_previous(const long t_x, const long t_y, const int t_z) const;
+    void keep(const long t_x, const long t_y, const int t_z) const;
+
+    void set_sampling(const sampling_policy & the_sampling)
+        { sampling_table = the_sampling; }
+    const sampling_options & sampling(const int t_z) const
+        { return sampling_table.at(t_z); }
+
+    // What to call the tile in progress output.
+    std::string name(const long t_x, const long t_y, const int t_z) const;
+
+    // Tiles rendered or put empty, how many of those were files left alone
+    // because they came out the same as before, and tiles kept.
+    size_t rendered_count(void) const { return rendered; }
+    size_t identical_count(void) const { return identical; }
+    size_t kept_count(void) const { return kept; }
+
+    const tile_format format;
+
+private:
+    void put(const long t_x, const long t_y, const int t_z,
+            const std::vector<unsigned char> & png) const;
+
+    const std::string name_prefix;
+    tile_store_writer * const store;
+    const tile_store_reader * const previous;
+    std::string empty_path;
+    std::vector<unsigned char> empty_png;
+    sampling_policy sampling_table;
+
+    mutable boost::atomic<size_t> rendered, identical, kept;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_TILE_OUTPUT_HPP
@@ -0,0 +1,729 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cerrno>
+#include <sys/stat.h>
+#include <poll.h>
+#include <exception>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "single_site_tile.hpp"
+#include "site_cache.hpp"
+#include "tile_cache.hpp"
+#include "tile_store.hpp"
+#include "coverage_index.hpp"
+#include "bounds_test.hpp"
+#include "coverage.hpp"
+#include "geo_math.hpp"
+
+/*
+ * Serves tiles over HTTP straight out of memory. Each site's cut, pyramid and
+ * coverage summary are loaded the first time the site is asked for and kept
+ * until its base file changes, so a request costs one tile's worth of
+ * sampling rather than a process start, an archive load and a pyramid build.
+ *
+ * Requests look like GET /KLVX/z/x/y.png for colorized tiles and
+ * GET /KLVX/z/x/y.data.png for data tiles. Tiles off the edge of the site's
+ * coverage get a 404, like gen-one prints. Rendered tiles are kept in a tile
+ * cache until it fills up or a new volume comes in for the site.
+ *
+ * Given a store directory, tiles found in the tile store that generate
+ * --store packed for the site's current volume are served straight out of
+ * the mapped store, and only tiles missing from it are rendered.
+ *
+ * Given a coverage index, GET /sites/z/x/y lists the sites covering that
+ * tile, one per line, for whoever is deciding which sites' tiles to ask for.
+ *
+ * Connections are accepted on one thread and handed to a fixed pool of
+ * workers, each serving one connection at a time with plain blocking reads
+ * and writes. Connections are kept alive, but since each one ties up a
+ * worker, one that goes quiet for REQUEST_TIMEOUT_MS is closed, and none is
+ * kept alive while other connections are waiting for a worker. Request
+ * headers are limited to MAX_REQUEST_HEADER_BYTES, and a request with a
+ * body, which no request here needs, is answered and the connection closed
+ * rather than the body read.
+ */
+
+namespace {
+
+using namespace tile_generator;
+namespace asio = boost::asio;
+
+const int REQUEST_TIMEOUT_MS = 10000;
+const size_t MAX_REQUEST_HEADER_BYTES = 16384;
+
+/*
+ * Blocking queue of accepted connections, each wrapped up as the job of
+ * serving it.
+ */
+class job_queue : boost::noncopyable
+{
+public:
+    void push(const boost::function<void (void)> & job)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        job_available.notify_one();
+    }
+
+    boost::function<void (void)> pop(void)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (jobs.empty())
+            job_available.wait(lock);
+        boost::function<void (void)> job = jobs.front();
+        jobs.pop_front();
+        return job;
+    }
+
+    // Whether any jobs are waiting for a worker to be free.
+    bool waiting(void)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        return !jobs.empty();
+    }
+
+private:
+    boost::mutex                              mutex;
+    boost::condition_variable                 job_available;
+    std::deque< boost::function<void (void)> > jobs;
+};
+
+void
+worker_loop(job_queue & queue)
+{
+    for (;;)
+        queue.pop()();
+}
+
+/*
+ * The tile stores for the current volume of each site, opened the first time
+ * they are needed. Opening a newer site's store closes the older one, once
+ * the last response using it is done with it.
+ */
+class store_cache : boost::noncopyable
+{
+public:
+    explicit store_cache(const std::string & the_store_dir)
+        : store_dir(the_store_dir) { }
+
+    boost::shared_ptr<const tile_store_reader> get(const simple_cut & cut,
+            const tile_format format)
+    {
+        const std::string name = tile_store_name(cut, format);
+        const std::string key =
+            cut.radar_identifier + tile_suffix(format);
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stores_type::const_iterator iter = stores.find(key);
+            if (iter != stores.end() && iter->second.first == name)
+                return iter->second.second;
+        }
+
+        // Not there yet, or not finished yet, is the usual case, so don't
+        // make a fuss about it.
+        boost::shared_ptr<const tile_store_reader> store;
+        struct stat st;
+        const std::string path = store_dir + "/" + name;
+        if (::stat(path.c_str(), &st) != 0)
+            return store;
+        try
+        {
+            store.reset(new tile_store_reader(path));
+        }
+        catch (tile_store_error & e)
+        {
+            std::cerr << e.what() << std::endl;
+            return store;
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stores[key] = std::make_pair(name, store);
+        return store;
+    }
+
+private:
+    typedef std::map< std::string, std::pair<std::string,
+            boost::shared_ptr<const tile_store_reader> > > stores_type;
+
+    const std::string store_dir;
+    boost::mutex mutex;
+    stores_type stores;
+};
+
+/*
+ * Everything the workers share.
+ */
+struct server_state : boost::noncopyable
+{
+    server_state(const std::string & base_dir, const size_t cache_bytes,
+            const std::string & store_dir,
+            std::auto_ptr<const coverage_index> the_index)
+        : sites(base_dir), tiles(cache_bytes), index(the_index)
+    {
+        if (!store_dir.empty())
+            stores.reset(new store_cache(store_dir));
+    }
+
+    site_cache sites;
+    tile_cache tiles;
+    std::auto_ptr<store_cache> stores;
+    const std::auto_ptr<const coverage_index> index;
+};
+
+/*
+ * The response body is held by whatever owns its bytes, a cached tile or a
+ * mapped tile store, for as long as the response needs them.
+ */
+struct http_response
+{
+    http_response() : status(200), reason("OK"),
+        content_type("image/png"), radar("generated") { }
+
+    int status;
+    std::string reason;
+    std::string content_type;
+    std::string radar;
+    boost::shared_ptr<const void> body_owner;
+    asio::const_buffer body;
+
+    void set_body(const tile_cache::tile_ptr & tile)
+    {
+        body_owner = tile;
+        body = asio::buffer(*tile);
+    }
+
+    void set_error(const int the_status, const std::string & the_reason)
+    {
+        status = the_status;
+        reason = the_reason;
+        content_type = "text/plain";
+        radar.clear();
+        const std::string text = reason + "\n";
+        set_body(tile_cache::tile_ptr(
+                    new tile_cache::tile_data(text.begin(), text.end())));
+    }
+};
+
+bool
+is_site_name(const std::string & s)
+{
+    if (s.size() != 4)
+        return false;
+    for (size_t i = 0;
+            i != s.size();
+            ++i)
+        if (s[i] < 'A' || s[i] > 'Z')
+            return false;
+    return true;
+}
+
+/*
+ * Split /SITE/z/x/y.png or /SITE/z/x/y.data.png into its parts. Returns false
+ * if the path isn't a tile path at all.
+ */
+bool
+parse_tile_path(const std::string & path, std::string & site, int & t_x,
+        int & t_y, int & t_z, tile_format & format)
+{
+    std::vector<std::string> parts;
+    boost::split(parts, path, boost::is_any_of("/"));
+    if (parts.size() != 5 || !parts[0].empty() || !is_site_name(parts[1]))
+        return false;
+
+    std::string y_part = parts[4];
+    const std::string data_suffix = tile_suffix(TILE_DATA);
+    const std::string colorized_suffix = tile_suffix(TILE_COLORIZED);
+    if (boost::ends_with(y_part, data_suffix))
+    {
+        format = TILE_DATA;
+        y_part.erase(y_part.size() - data_suffix.size());
+    }
+    else if (boost::ends_with(y_part, colorized_suffix))
+    {
+        format = TILE_COLORIZED;
+        y_part.erase(y_part.size() - colorized_suffix.size());
+    }
+    else
+        return false;
+
+    try
+    {
+        t_z = boost::lexical_cast<int>(parts[2]);
+        t_x = boost::lexical_cast<int>(parts[3]);
+        t_y = boost::lexical_cast<int>(y_part);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        return false;
+    }
+
+    site = parts[1];
+    return t_z >= 0 && t_z < 31 && t_x >= 0 && t_x < (1 << t_z)
+        && t_y >= 0 && t_y < (1 << t_z);
+}
+
+/*
+ * Split /sites/z/x/y into its parts. Returns false if the path isn't a sites
+ * path at all.
+ */
+bool
+parse_sites_path(const std::string & path, int & t_x, int & t_y, int & t_z)
+{
+    std::vector<std::string> parts;
+    boost::split(parts, path, boost::is_any_of("/"));
+    if (parts.size() != 5 || !parts[0].empty() || parts[1] != "sites")
+        return false;
+
+    try
+    {
+        t_z = boost::lexical_cast<int>(parts[2]);
+        t_x = boost::lexical_cast<int>(parts[3]);
+        t_y = boost::lexical_cast<int>(parts[4]);
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        return false;
+    }
+
+    return t_z >= 0 && t_z < 31 && t_x >= 0 && t_x < (1 << t_z)
+        && t_y >= 0 && t_y < (1 << t_z);
+}
+
+/*
+ * List the sites covering the tile at the given sites path, from the
+ * coverage index.
+ */
+void
+serve_sites(server_state & state, const std::string & path,
+        http_response & response)
+{
+    int t_x, t_y, t_z;
+    if (!state.index.get())
+    {
+        response.set_error(404, "Not Found");
+        return;
+    }
+    if (!parse_sites_path(path, t_x, t_y, t_z))
+    {
+        response.set_error(400, "Bad Request");
+        return;
+    }
+
+    std::vector<size_t> found;
+    state.index->find(t_x, t_y, t_z, found);
+
+    std::string text;
+    std::vector<size_t>::const_iterator iter;
+    for (iter = found.begin();
+            iter != found.end();
+            ++iter)
+        text += state.index->sites()[*iter].radar_identifier + "\n";
+
+    response.content_type = "text/plain";
+    response.radar.clear();
+    response.set_body(tile_cache::tile_ptr(
+                new tile_cache::tile_data(text.begin(), text.end())));
+}
+
+/*
+ * Render a tile for the tile cache.
+ */
+void
+render_tile(const boost::shared_ptr<const loaded_site> loaded, const int t_x,
+        const int t_y, const int t_z, const tile_format format,
+        std::vector<unsigned char> & png)
+{
+    if (loaded->coverage.classify(t_x, t_y, t_z) == COVERAGE_EMPTY)
+        encode_empty_tile(png, format);
+    else
+        encode_tile(loaded->pyramid, t_x, t_y, t_z, png, format);
+}
+
+/*
+ * Find the tile at the given path for the response, in the tile store if
+ * there is one or else in the tile cache, rendering it if it isn't cached.
+ */
+void
+serve_tile(server_state & state, const std::string & path,
+        http_response & response)
+{
+    std::string site;
+    int t_x = 0, t_y = 0, t_z = 0;
+    tile_format format = TILE_COLORIZED;
+    if (!parse_tile_path(path, site, t_x, t_y, t_z, format))
+    {
+        response.set_error(400, "Bad Request");
+        return;
+    }
+
+    const boost::shared_ptr<const loaded_site> loaded = state.sites.get(site);
+    if (!loaded || !test_tile_intersection(t_x, t_y, t_z,
+                to_rad(loaded->cut.latitude), to_rad(loaded->cut.longitude),
+                300000.0))
+    {
+        response.set_error(404, "Not Found");
+        response.radar = "no-coverage";
+        return;
+    }
+
+    if (state.stores.get())
+    {
+        const boost::shared_ptr<const tile_store_reader> store =
+            state.stores->get(loaded->cut, format);
+        const unsigned char * data;
+        size_t length;
+        if (store && store->find(t_x, t_y, t_z, data, length))
+        {
+            response.body_owner = store;
+            response.body = asio::buffer(data, length);
+            response.radar = "stored";
+            return;
+        }
+    }
+
+    bool hit;
+    response.set_body(state.tiles.get(
+            tile_key(site, loaded->cut.start_timestamp, t_x, t_y, t_z,
+                format),
+            boost::bind(&render_tile, loaded, t_x, t_y, t_z, format, _1),
+            hit));
+    if (hit)
+        response.radar = "cached";
+}
+
+template <typename Socket>
+void
+write_response(Socket & socket, const http_response & response,
+        const bool keep_alive, const bool head_only)
+{
+    std::string header = (boost::format(
+            "HTTP/1.1 %1% %2%\r\n"
+            "Content-Type: %3%\r\n"
+            "Content-Length: %4%\r\n"
+            "Connection: %5%\r\n")
+        % response.status % response.reason % response.content_type
+        % asio::buffer_size(response.body) % (keep_alive ? "keep-alive" : "close")).str();
+    if (!response.radar.empty())
+        header += "X-NeoWX-Radar: " + response.radar + "\r\n";
+    header += "\r\n";
+
+    std::vector<asio::const_buffer> buffers;
+    buffers.push_back(asio::buffer(header));
+    if (!head_only && asio::buffer_size(response.body) != 0)
+        buffers.push_back(response.body);
+    asio::write(socket, buffers);
+}
+
+enum request_header_status
+{
+    REQUEST_HEADER_READ,
+    REQUEST_HEADER_TIMED_OUT,
+    REQUEST_HEADER_TOO_LARGE
+};
+
+/*
+ * Read until the end of a request header is in the buffer, like
+ * asio::read_until(), but giving up if it hasn't come within
+ * REQUEST_TIMEOUT_MS or has grown past MAX_REQUEST_HEADER_BYTES. The
+ * socket is polled for its deadline before each read, so the read itself
+ * never blocks.
+ */
+template <typename Socket>
+request_header_status
+read_request_header(Socket & socket, asio::streambuf & buf)
+{
+    using namespace boost::posix_time;
+    const ptime deadline = microsec_clock::universal_time()
+        + milliseconds(REQUEST_TIMEOUT_MS);
+    const char header_end[] = "\r\n\r\n";
+
+    for (;;)
+    {
+        if (std::search(asio::buffers_begin(buf.data()),
+                    asio::buffers_end(buf.data()), header_end,
+                    header_end + 4) != asio::buffers_end(buf.data()))
+            return REQUEST_HEADER_READ;
+        if (buf.size() >= MAX_REQUEST_HEADER_BYTES)
+            return REQUEST_HEADER_TOO_LARGE;
+
+        const long remaining_ms =
+            (deadline - microsec_clock::universal_time()).total_milliseconds();
+        if (remaining_ms <= 0)
+            return REQUEST_HEADER_TIMED_OUT;
+
+        pollfd pfd;
+        pfd.fd = socket.native_handle();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        const int ready = ::poll(&pfd, 1, static_cast<int>(remaining_ms));
+        if (ready < 0 && errno != EINTR)
+            throw boost::system::system_error(errno,
+                    boost::system::system_category());
+        if (ready <= 0)
+            continue;
+
+        buf.commit(socket.read_some(
+                    buf.prepare(MAX_REQUEST_HEADER_BYTES - buf.size())));
+    }
+}
+
+/*
+ * Serve requests on a connection until the client closes it, asks for it to
+ * be closed, or goes quiet, or until other connections are waiting.
+ */
+template <typename Socket>
+void
+serve_connection(boost::shared_ptr<Socket> socket, server_state & state,
+        job_queue & queue)
+{
+    asio::streambuf buf;
+    try
+    {
+        for (;;)
+        {
+            const request_header_status status =
+                read_request_header(*socket, buf);
+            if (status == REQUEST_HEADER_TIMED_OUT)
+                break;
+            else if (status == REQUEST_HEADER_TOO_LARGE)
+            {
+                http_response response;
+                response.set_error(431, "Request Header Fields Too Large");
+                write_response(*socket, response, false, false);
+                break;
+            }
+            std::istream is(&buf);
+
+            std::string method, target, version, line;
+            std::getline(is, line);
+            {
+                std::istringstream request_line(line);
+                request_line >> method >> target >> version;
+            }
+
+            // HTTP/1.1 keeps the connection open unless told otherwise,
+            // HTTP/1.0 closes it unless told otherwise.
+            bool keep_alive = (version == "HTTP/1.1");
+            bool has_body = false;
+            while (std::getline(is, line) && line != "\r")
+            {
+                const size_t colon = line.find(':');
+                if (colon == std::string::npos)
+                    continue;
+                const std::string name =
+                    boost::to_lower_copy(line.substr(0, colon));
+                const std::string value =
+                    boost::to_lower_copy(boost::trim_copy(
+                                line.substr(colon + 1)));
+                if (name == "connection")
+                    keep_alive = (value == "keep-alive");
+                else if ((name == "content-length" && value != "0")
+                        || name == "transfer-encoding")
+                    has_body = true;
+            }
+            if (has_body || queue.waiting())
+                keep_alive = false;
+
+            const size_t query = target.find('?');
+            if (query != std::string::npos)
+                target.erase(query);
+
+            http_response response;
+            if (method != "GET" && method != "HEAD")
+                response.set_error(405, "Method Not Allowed");
+            else
+            {
+                try
+                {
+                    if (boost::starts_with(target, "/sites/"))
+                        serve_sites(state, target, response);
+                    else
+                        serve_tile(state, target, response);
+                }
+                catch (std::exception & e)
+                {
+                    std::cerr << target << ": " << e.what() << std::endl;
+                    response.set_error(500, "Internal Server Error");
+                }
+            }
+
+            write_response(*socket, response, keep_alive, method == "HEAD");
+            if (!keep_alive)
+                break;
+        }
+    }
+    catch (boost::system::system_error & e)
+    {
+        // Client went away, so there's nobody left to answer.
+    }
+}
+
+template <typename Protocol>
+void
+accept_loop(asio::io_service & io, asio::basic_socket_acceptor<Protocol> &
+        acceptor, server_state & state, job_queue & queue)
+{
+    typedef typename Protocol::socket socket_type;
+    for (;;)
+    {
+        boost::shared_ptr<socket_type> socket(new socket_type(io));
+        boost::system::error_code ec;
+        acceptor.accept(*socket, ec);
+        if (ec)
+        {
+            std::cerr << "accept: " << ec.message() << std::endl;
+            continue;
+        }
+        queue.push(boost::bind(&serve_connection<socket_type>, socket,
+                    boost::ref(state), boost::ref(queue)));
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    using std::cout;
+    using namespace tile_generator;
+    cout.sync_with_stdio(false);
+
+    // Optional leading --threads N, for the number of connections served at
+    // once, --cache-mb N, for how much memory to keep tiles in, and
+    // --store-dir DIR, for where to look for packed tile stores, and
+    // --coverage-index FILE, for the index coverage-index built of which
+    // sites cover which tiles.
+    unsigned int threads = boost::thread::hardware_concurrency();
+    size_t cache_bytes = TILE_CACHE_DEFAULT_BYTES;
+    std::string store_dir;
+    std::auto_ptr<const coverage_index> index;
+    for (;;)
+    {
+        if (argc > 2 && std::string(argv[1]) == "--threads")
+        {
+            try
+            {
+                threads = boost::lexical_cast<unsigned int>(argv[2]);
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad thread count" << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--cache-mb")
+        {
+            try
+            {
+                cache_bytes =
+                    boost::lexical_cast<size_t>(argv[2]) * 1024 * 1024;
+            }
+            catch (boost::bad_lexical_cast & e)
+            {
+                cout << "bad cache size" << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--store-dir")
+        {
+            store_dir = argv[2];
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 2 && std::string(argv[1]) == "--coverage-index")
+        {
+            try
+            {
+                index.reset(new coverage_index(argv[2]));
+            }
+            catch (coverage_index_error & e)
+            {
+                cout << e.what() << std::endl;
+                return 1;
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else
+            break;
+    }
+    if (threads == 0)
+        threads = 1;
+
+    if (argc != 3)
+    {
+        cout
+            << "usage: tile-server [--threads N] [--cache-mb N] "
+               "[--store-dir DIR]\n"
+               "                   [--coverage-index FILE] <basedir> "
+               "<port | unix:path>"
+            << std::endl;
+        return 1;
+    }
+
+    server_state state(argv[1], cache_bytes, store_dir, index);
+    job_queue queue;
+    boost::thread_group workers;
+    for (unsigned int i = 0;
+            i != threads;
+            ++i)
+        workers.create_thread(boost::bind(&worker_loop, boost::ref(queue)));
+
+    const std::string endpoint(argv[2]);
+    asio::io_service io;
+    try
+    {
+        if (boost::starts_with(endpoint, "unix:"))
+        {
+            typedef asio::local::stream_protocol protocol;
+            const std::string path = endpoint.substr(5);
+            std::remove(path.c_str());
+            protocol::acceptor acceptor(io, protocol::endpoint(path));
+            accept_loop(io, acceptor, state, queue);
+        }
+        else
+        {
+            typedef asio::ip::tcp protocol;
+            const unsigned short port =
+                boost::lexical_cast<unsigned short>(endpoint);
+            protocol::acceptor acceptor(io,
+                    protocol::endpoint(protocol::v4(), port));
+            accept_loop(io, acceptor, state, queue);
+        }
+    }
+    catch (boost::bad_lexical_cast & e)
+    {
+        cout << "bad port" << std::endl;
+        return 1;
+    }
+    catch (boost::system::system_error & e)
+    {
+        cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
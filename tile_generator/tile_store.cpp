@@ -0,0 +1,257 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "tile_store.hpp"
+
+namespace tile_generator {
+
+void
+store_le32(unsigned char * bytes, const boost::uint32_t value)
+{
+    for (int i = 0;
+            i != 4;
+            ++i)
+        bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+void
+store_le64(unsigned char * bytes, const boost::uint64_t value)
+{
+    for (int i = 0;
+            i != 8;
+            ++i)
+        bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+boost::uint32_t
+load_le32(const unsigned char * bytes)
+{
+    return boost::uint32_t(bytes[0]) | (boost::uint32_t(bytes[1]) << 8)
+        | (boost::uint32_t(bytes[2]) << 16)
+        | (boost::uint32_t(bytes[3]) << 24);
+}
+
+boost::uint64_t
+load_le64(const unsigned char * bytes)
+{
+    return boost::uint64_t(load_le32(bytes))
+        | (boost::uint64_t(load_le32(bytes + 4)) << 32);
+}
+
+/*
+ * The name of a site's tile store, SITE_YYYYMMDDTHHMMSS.tiles, for the start
+ * of the volume, or .data.tiles for data tiles.
+ */
+std::string
+tile_store_name(const base_extract::simple_cut & cut,
+        const tile_format format)
+{
+    return cut.radar_identifier + "_"
+        + boost::posix_time::to_iso_string(cut.start_timestamp)
+        + (format == TILE_DATA ? ".data.tiles" : ".tiles");
+}
+
+/*
+ * Where generate puts a site's tile store.
+ */
+std::string
+tile_store_path(const base_extract::simple_cut & cut,
+        const tile_format format)
+{
+    return "out/" + tile_store_name(cut, format);
+}
+
+tile_store_writer::tile_store_writer(const std::string & the_filename)
+    : final_name(the_filename), part_name(the_filename + ".part"),
+        fd(-1), end_offset(TILE_STORE_HEADER_BYTES)
+{
+    fd = ::open(part_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        throw tile_store_error(part_name + ": " + std::strerror(errno));
+
+    unsigned char header[TILE_STORE_HEADER_BYTES];
+    std::memcpy(header, TILE_STORE_MAGIC, sizeof(TILE_STORE_MAGIC));
+    store_le32(header + 8, TILE_STORE_VERSION);
+    store_le32(header + 12, 0);
+    write_at(header, sizeof(header), 0);
+}
+
+/*
+ * A store that was never finished is left behind as filename.part, for
+ * whoever wants to know what happened to it.
+ */
+tile_store_writer::~tile_store_writer()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void
+tile_store_writer::add(const long t_x, const long t_y, const int t_z,
+        const std::vector<unsigned char> & tile)
+{
+    const bool dedup = (tile.size() <= TILE_STORE_DEDUP_MAX_BYTES);
+    extent place;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (fd < 0)
+            throw tile_store_error(final_name + ": already finished");
+
+        dedup_type::const_iterator iter;
+        if (dedup && (iter = small_tiles.find(tile)) != small_tiles.end())
+        {
+            index[index_key(t_z, t_x, t_y)] = iter->second;
+            return;
+        }
+
+        place = extent(end_offset, tile.size());
+        end_offset += tile.size();
+        index[index_key(t_z, t_x, t_y)] = place;
+        if (dedup)
+            small_tiles.insert(std::make_pair(tile, place));
+    }
+
+    // The space is ours now, so the write itself needs no lock.
+    if (!tile.empty())
+        write_at(&tile[0], tile.size(), place.first);
+}
+
+/*
+ * Write the index and trailer and move the store into place. Every add() must
+ * have returned before this is called.
+ */
+void
+tile_store_writer::finish(void)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+
+    std::vector<unsigned char> tail(index.size() * TILE_STORE_ENTRY_BYTES
+            + TILE_STORE_TRAILER_BYTES);
+    unsigned char * p = &tail[0];
+    index_type::const_iterator iter;
+    for (iter = index.begin();
+            iter != index.end();
+            ++iter)
+    {
+        store_le32(p, boost::get<0>(iter->first));
+        store_le32(p + 4, boost::get<1>(iter->first));
+        store_le32(p + 8, boost::get<2>(iter->first));
+        store_le32(p + 12, iter->second.second);
+        store_le64(p + 16, iter->second.first);
+        p += TILE_STORE_ENTRY_BYTES;
+    }
+    store_le64(p, end_offset);
+    store_le64(p + 8, index.size());
+    write_at(&tail[0], tail.size(), end_offset);
+
+    if (::close(fd) != 0)
+    {
+        fd = -1;
+        throw tile_store_error(part_name + ": " + std::strerror(errno));
+    }
+    fd = -1;
+    if (std::rename(part_name.c_str(), final_name.c_str()) != 0)
+        throw tile_store_error(final_name + ": " + std::strerror(errno));
+}
+
+void
+tile_store_writer::write_at(const unsigned char * data, const size_t length,
+        boost::uint64_t offset)
+{
+    size_t done = 0;
+    while (done != length)
+    {
+        const ssize_t n = ::pwrite(fd, data + done, length - done,
+                offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw tile_store_error(part_name + ": " + std::strerror(errno));
+        done += n;
+    }
+}
+
+tile_store_reader::tile_store_reader(const std::string & filename)
+    : index(0), count(0)
+{
+    try
+    {
+        file.open(filename);
+    }
+    catch (std::exception & e)
+    {
+        throw tile_store_error(filename + ": " + e.what());
+    }
+
+    const unsigned char * const base =
+        reinterpret_cast<const unsigned char *>(file.data());
+    const size_t size = file.size();
+    if (size < TILE_STORE_HEADER_BYTES + TILE_STORE_TRAILER_BYTES
+            || std::memcmp(base, TILE_STORE_MAGIC,
+                sizeof(TILE_STORE_MAGIC)) != 0)
+        throw tile_store_error(filename + ": not a tile store");
+    if (load_le32(base + 8) != TILE_STORE_VERSION)
+        throw tile_store_error(filename + ": unknown tile store version");
+
+    const unsigned char * const trailer =
+        base + size - TILE_STORE_TRAILER_BYTES;
+    const boost::uint64_t index_offset = load_le64(trailer);
+    const boost::uint64_t entries = load_le64(trailer + 8);
+    if (index_offset < TILE_STORE_HEADER_BYTES
+            || index_offset > size - TILE_STORE_TRAILER_BYTES
+            || entries != (size - TILE_STORE_TRAILER_BYTES - index_offset)
+                / TILE_STORE_ENTRY_BYTES
+            || (size - TILE_STORE_TRAILER_BYTES - index_offset)
+                % TILE_STORE_ENTRY_BYTES != 0)
+        throw tile_store_error(filename + ": corrupt tile store index");
+
+    index = base + index_offset;
+    count = entries;
+}
+
+bool
+tile_store_reader::find(const long t_x, const long t_y, const int t_z,
+        const unsigned char * & data, size_t & length) const
+{
+    typedef boost::tuple<boost::uint32_t, boost::uint32_t, boost::uint32_t>
+        key_t;
+    const key_t key(t_z, t_x, t_y);
+
+    size_t lo = 0, hi = count;
+    while (lo != hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        const unsigned char * const entry =
+            index + mid * TILE_STORE_ENTRY_BYTES;
+        const key_t mid_key(load_le32(entry), load_le32(entry + 4),
+                load_le32(entry + 8));
+
+        if (mid_key < key)
+            lo = mid + 1;
+        else if (key < mid_key)
+            hi = mid;
+        else
+        {
+            const boost::uint32_t tile_length = load_le32(entry + 12);
+            const boost::uint64_t offset = load_le64(entry + 16);
+            const unsigned char * const base =
+                reinterpret_cast<const unsigned char *>(file.data());
+            if (offset + tile_length > static_cast<boost::uint64_t>(
+                        index - base))
+                return false;
+            data = base + offset;
+            length = tile_length;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace tile_generator
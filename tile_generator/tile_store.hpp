@@ -0,0 +1,126 @@
+#ifndef RSME_INCLUDED_TILE_STORE_HPP
+#define RSME_INCLUDED_TILE_STORE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <exception>
+#include <boost/cstdint.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "single_site_tile.hpp"
+#include "../base_extract/simple_cut.hpp"
+
+namespace tile_generator {
+
+/*
+ * A tile store packs every tile of one site's volume into a single file:
+ *
+ *   header   "RSMETILE", u32 version, u32 zero
+ *   tiles    the encoded tiles, back to back, in no particular order
+ *   index    one entry per tile, sorted by z, then x, then y:
+ *            u32 z, u32 x, u32 y, u32 length, u64 offset
+ *   trailer  u64 index offset, u64 entry count
+ *
+ * All integers are little endian. Tiles with identical contents, such as all
+ * the empty ones, are stored once and shared between index entries.
+ */
+const char TILE_STORE_MAGIC[8] = { 'R', 'S', 'M', 'E', 'T', 'I', 'L', 'E' };
+const boost::uint32_t TILE_STORE_VERSION = 1;
+const size_t TILE_STORE_HEADER_BYTES = 16;
+const size_t TILE_STORE_ENTRY_BYTES = 24;
+const size_t TILE_STORE_TRAILER_BYTES = 16;
+
+/*
+ * Tiles no bigger than this are checked for duplicates before being stored.
+ * Duplicates are almost all blank or uniform tiles, which encode small, so
+ * this catches them without holding on to a copy of every tile.
+ */
+const size_t TILE_STORE_DEDUP_MAX_BYTES = 1024;
+
+class tile_store_error : public std::exception
+{
+public:
+    explicit tile_store_error(const std::string & the_message)
+        : message(the_message) { }
+    ~tile_store_error() throw() { }
+
+    virtual const char * what(void) const throw()
+    {
+        return message.c_str();
+    }
+
+private:
+    std::string message;
+};
+
+std::string tile_store_name(const base_extract::simple_cut & cut,
+        const tile_format format = TILE_COLORIZED);
+std::string tile_store_path(const base_extract::simple_cut & cut,
+        const tile_format format = TILE_COLORIZED);
+
+/*
+ * Writes a tile store. Tiles may be added from several threads at once: each
+ * add reserves its place at the end of the file under a lock and writes the
+ * tile outside it. The store is written to filename.part and only renamed
+ * into place, index and all, by finish(), so readers never see a partial
+ * store.
+ */
+class tile_store_writer : boost::noncopyable
+{
+public:
+    explicit tile_store_writer(const std::string & the_filename);
+    ~tile_store_writer();
+
+    void add(const long t_x, const long t_y, const int t_z,
+            const std::vector<unsigned char> & tile);
+    void finish(void);
+
+    const std::string & filename(void) const { return final_name; }
+
+private:
+    typedef boost::tuple<int, long, long> index_key;
+    typedef std::pair<boost::uint64_t, boost::uint32_t> extent;
+    typedef std::map<index_key, extent> index_type;
+    typedef std::map<std::vector<unsigned char>, extent> dedup_type;
+
+    const std::string final_name;
+    const std::string part_name;
+    int fd;
+
+    boost::mutex    mutex;
+    boost::uint64_t end_offset;
+    index_type      index;
+    dedup_type      small_tiles;
+
+    void write_at(const unsigned char * data, const size_t length,
+            boost::uint64_t offset);
+};
+
+/*
+ * Reads a finished tile store by mapping it into memory, so finding a tile
+ * hands back a pointer straight into the mapping. Lookups are a binary search
+ * of the index and are safe from any number of threads.
+ */
+class tile_store_reader : boost::noncopyable
+{
+public:
+    explicit tile_store_reader(const std::string & filename);
+
+    bool find(const long t_x, const long t_y, const int t_z,
+            const unsigned char * & data, size_t & length) const;
+    size_t tile_count(void) const { return count; }
+
+private:
+    boost::iostreams::mapped_file_source file;
+    const unsigned char * index;
+    size_t count;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_TILE_STORE_HPP
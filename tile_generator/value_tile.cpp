@@ -0,0 +1,183 @@
+#include <boost/gil/typedefs.hpp>
+#include <boost/gil/image.hpp>
+
+#include "value_tile.hpp"
+#include "single_site_tile.hpp"
+#include "tile_coord.hpp"
+#include "png_encoder.hpp"
+
+namespace tile_generator {
+
+namespace gil = boost::gil;
+
+/*
+ * Sample a rectangle of a tile, in pixels from the tile origin, into the same
+ * place in a value tile. By default the whole tile is sampled. Squares with
+ * a side that is a power of two, which includes the whole tile and its
+ * quadrants, can be sampled in Z order; anything else is sampled row by
+ * row.
+ */
+void
+sample_value_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, value_tile & out,
+        const sampling_options & sampling, const int x_0, const int y_0,
+        const int width, const int height)
+{
+    sample_value_tile(tile_sampler(pyramid, t_x, t_y, t_z, sampling), out,
+            x_0, y_0, width, height);
+}
+
+/*
+ * Same as above, with the tile and how to sample it given by a sampler.
+ */
+void
+sample_value_tile(const tile_sampler & sampler, value_tile & out,
+        const int x_0, const int y_0, const int width, const int height)
+{
+    if (sampler.sampling.order == PIXELS_Z_ORDER && width == height && width > 0
+            && (width & (width - 1)) == 0)
+    {
+        for (int i = 0;
+                i != width * height;
+                ++i)
+        {
+            int x, y;
+            z_order_pixel(i, x, y);
+            out(x_0 + x, y_0 + y) = sampler.pixel(x_0 + x, y_0 + y);
+        }
+        return;
+    }
+
+    for (int y = y_0;
+            y != y_0 + height;
+            ++y)
+        for (int x = x_0;
+                x != x_0 + width;
+                ++x)
+            out(x, y) = sampler.pixel(x, y);
+}
+
+/*
+ * Reduce a tile by 2x into one quadrant of its parent at the next lower zoom
+ * level. Quadrant (0, 0) is the upper left. Each parent pixel covers exactly
+ * a 2x2 block of child pixels, so this is a plain box filter.
+ */
+void
+downsample_quadrant(const value_tile & child, const int q_x, const int q_y,
+        value_tile & parent)
+{
+    const int HALF = TILE_DIMENSION_PIXELS / 2;
+
+    for (int y = 0;
+            y != HALF;
+            ++y)
+        for (int x = 0;
+                x != HALF;
+                ++x)
+        {
+            const radar_value_t & a = child(2 * x,     2 * y);
+            const radar_value_t & b = child(2 * x + 1, 2 * y);
+            const radar_value_t & c = child(2 * x,     2 * y + 1);
+            const radar_value_t & d = child(2 * x + 1, 2 * y + 1);
+
+            parent(q_x * HALF + x, q_y * HALF + y) = radar_value_t(
+                    (a.first + b.first + c.first + d.first) / 4.0,
+                    (a.second + b.second + c.second + d.second) / 4.0);
+        }
+}
+
+/*
+ * Tone map a value tile with the colorized TMO and encode it as a PNG. Like
+ * write_colorized_tile(), returns whether any pixel came out non-transparent.
+ */
+bool
+encode_colorized_value_tile(const value_tile & tile,
+        std::vector<unsigned char> & png, const png_options & options)
+{
+    typedef gil::rgba8_pixel_t pixel_t;
+
+    const colorized_tmo<pixel_t> tmo;
+    gil::rgba8_image_t img(TILE_DIMENSION_PIXELS, TILE_DIMENSION_PIXELS);
+    gil::rgba8_view_t v = gil::view(img);
+    bool significant = false;
+
+    for (int y = 0;
+            y != TILE_DIMENSION_PIXELS;
+            ++y)
+    {
+        gil::rgba8_view_t::x_iterator row = v.row_begin(y);
+        for (int x = 0;
+                x != TILE_DIMENSION_PIXELS;
+                ++x)
+        {
+            row[x] = tmo(tile(x, y));
+            if (gil::semantic_at_c<3>(row[x]) > 0)
+                significant = true;
+        }
+    }
+
+    encode_png(gil::const_view(img), png, options);
+    return significant;
+}
+
+bool
+write_colorized_value_tile(const value_tile & tile, const char * filename)
+{
+    std::vector<unsigned char> png;
+    const bool significant = encode_colorized_value_tile(tile, png);
+    write_png_buffer(png, filename);
+    return significant;
+}
+
+/*
+ * Encode a value tile as a data tile, an 8-bit gray and alpha PNG. The gray
+ * channel is the quantized measurement and the alpha channel the validity,
+ * so the client can apply whatever color table it likes. Returns whether the
+ * colorized TMO would have made any pixel non-transparent, so data tiles can
+ * be pruned the same way as colorized ones.
+ */
+bool
+encode_data_tile(const value_tile & tile, std::vector<unsigned char> & png,
+        const png_options & options)
+{
+    const colorized_tmo<gil::rgba8_pixel_t> tmo;
+    std::vector<unsigned char> pixels(tile.values.size() * 2);
+    bool significant = false;
+
+    for (size_t i = 0;
+            i != tile.values.size();
+            ++i)
+    {
+        const radar_value_t & rv = tile.values[i];
+
+        float value = 0.0;
+        if (rv.second > 0.0)
+        {
+            value = rv.first * DATA_TILE_SCALE + DATA_TILE_OFFSET + 0.5;
+            if (value < 2.0) value = 2.0;
+            if (value > 255.0) value = 255.0;
+        }
+        pixels[i * 2] = static_cast<unsigned char>(value);
+        pixels[i * 2 + 1] =
+            static_cast<unsigned char>(rv.second * 255.0 + 0.5);
+
+        if (!significant && gil::semantic_at_c<3>(tmo(rv)) > 0)
+            significant = true;
+    }
+
+    encode_gray_alpha_png(pixels, TILE_DIMENSION_PIXELS,
+            TILE_DIMENSION_PIXELS, png, options);
+    return significant;
+}
+
+bool
+write_data_tile(const value_tile & tile, const char * filename)
+{
+    std::vector<unsigned char> png;
+    const bool significant = encode_data_tile(tile, png);
+    write_png_buffer(png, filename);
+
+    return significant;
+}
+
+} // namespace tile_generator
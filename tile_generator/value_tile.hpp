@@ -0,0 +1,66 @@
+#ifndef RSME_INCLUDED_VALUE_TILE_HPP
+#define RSME_INCLUDED_VALUE_TILE_HPP
+
+#include <vector>
+
+#include "tile_coord.hpp"
+#include "sample_cut.hpp"
+#include "polar_pyramid.hpp"
+#include "png_encoder.hpp"
+
+namespace tile_generator {
+
+struct tile_sampler;
+
+/*
+ * A tile's worth of sampled radar values, before tone mapping. Keeping tiles
+ * in this form lets them be filtered and combined without the roundoff and
+ * nonlinearity of the color table getting in the way.
+ */
+struct value_tile
+{
+    value_tile()
+        : values(TILE_DIMENSION_PIXELS * TILE_DIMENSION_PIXELS,
+                radar_value_t(0.0, 0.0)) { }
+
+    radar_value_t & operator()(const int x, const int y)
+        { return values[y * TILE_DIMENSION_PIXELS + x]; }
+    const radar_value_t & operator()(const int x, const int y) const
+        { return values[y * TILE_DIMENSION_PIXELS + x]; }
+
+    std::vector<radar_value_t> values;
+};
+
+/*
+ * Quantization of data tiles, which is the same as the level II reflectivity
+ * encoding: value = dBZ * 2 + 66, clamped to 2 to 255. Pixels with no valid
+ * data at all have a value of 0.
+ */
+const float DATA_TILE_SCALE = 2.0;
+const float DATA_TILE_OFFSET = 66.0;
+
+void sample_value_tile(const polar_pyramid & pyramid, const long t_x,
+        const long t_y, const int t_z, value_tile & out,
+        const sampling_options & sampling = sampling_options(),
+        const int x_0 = 0, const int y_0 = 0,
+        const int width = TILE_DIMENSION_PIXELS,
+        const int height = TILE_DIMENSION_PIXELS);
+void sample_value_tile(const tile_sampler & sampler, value_tile & out,
+        const int x_0 = 0, const int y_0 = 0,
+        const int width = TILE_DIMENSION_PIXELS,
+        const int height = TILE_DIMENSION_PIXELS);
+void downsample_quadrant(const value_tile & child, const int q_x,
+        const int q_y, value_tile & parent);
+bool encode_colorized_value_tile(const value_tile & tile,
+        std::vector<unsigned char> & png,
+        const png_options & options = png_options());
+bool write_colorized_value_tile(const value_tile & tile,
+        const char * filename);
+bool encode_data_tile(const value_tile & tile,
+        std::vector<unsigned char> & png,
+        const png_options & options = png_options());
+bool write_data_tile(const value_tile & tile, const char * filename);
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_VALUE_TILE_HPP
@@ -0,0 +1,219 @@
+#ifndef RSME_INCLUDED_WORK_STEALING_POOL_HPP
+#define RSME_INCLUDED_WORK_STEALING_POOL_HPP
+
+#include <deque>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace tile_generator {
+
+/*
+ * A pool of worker threads, each with its own deque of tasks. A worker takes
+ * tasks off the back of its own deque, so it works depth-first on whatever it
+ * pushed most recently, and when its deque runs dry it steals from the front
+ * of the others, which is where the oldest and (in a tree walk) biggest
+ * pieces of work are.
+ *
+ * Tasks may push further tasks onto their own worker's deque through the
+ * worker handle passed to them. run() returns once every task, including the
+ * ones pushed while running, has been processed.
+ */
+template <typename Task>
+class work_stealing_pool : boost::noncopyable
+{
+public:
+    /*
+     * Handle to the worker running a task, for pushing follow-on work.
+     */
+    class worker
+    {
+    public:
+        worker(work_stealing_pool & the_pool, const size_t the_id)
+            : pool(the_pool), id(the_id) { }
+
+        void push(const Task & task) { pool.push_to(id, task); }
+        size_t index(void) const { return id; }
+
+    private:
+        work_stealing_pool & pool;
+        const size_t id;
+    };
+
+    explicit work_stealing_pool(const size_t thread_count)
+        : next_seed(0), queued(0), pending(0), completed(0)
+    {
+        const size_t n = (thread_count > 0 ? thread_count : 1);
+        for (size_t i = 0;
+                i != n;
+                ++i)
+            queues.push_back(boost::shared_ptr<local_queue>(new local_queue));
+    }
+
+    /*
+     * Push a task from outside the pool. Seed tasks are spread round-robin
+     * across the workers.
+     */
+    void push(const Task & task)
+    {
+        push_to(next_seed, task);
+        next_seed = (next_seed + 1) % queues.size();
+    }
+
+    /*
+     * Process tasks until there are none left. The functor is called as
+     * fn(task, worker) and must be safe to call from several threads at once.
+     */
+    template <typename Function>
+    void run(Function fn)
+    {
+        boost::thread_group threads;
+        for (size_t i = 0;
+                i != queues.size();
+                ++i)
+            threads.create_thread(worker_loop<Function>(*this, i, fn));
+        threads.join_all();
+    }
+
+    size_t thread_count(void) const { return queues.size(); }
+
+    /*
+     * Snapshot of progress, for reporting. Outstanding counts tasks that have
+     * been pushed but not finished, including ones being processed now.
+     */
+    void progress(size_t & done, size_t & outstanding)
+    {
+        boost::lock_guard<boost::mutex> lock(state_mutex);
+        done = completed;
+        outstanding = pending;
+    }
+
+private:
+    struct local_queue
+    {
+        boost::mutex     mutex;
+        std::deque<Task> tasks;
+    };
+
+    template <typename Function>
+    struct worker_loop
+    {
+        worker_loop(work_stealing_pool & the_pool, const size_t the_id,
+                Function the_fn)
+            : pool(the_pool), id(the_id), fn(the_fn) { }
+
+        void operator()(void)
+        {
+            worker w(pool, id);
+            Task task;
+            while (pool.take(id, task))
+            {
+                fn(task, w);
+                pool.finish();
+            }
+        }
+
+        work_stealing_pool & pool;
+        size_t id;
+        Function fn;
+    };
+
+    void push_to(const size_t id, const Task & task)
+    {
+        // Count the task before it becomes visible, so nobody can see the
+        // pool drain to zero while it's still on its way in.
+        {
+            boost::lock_guard<boost::mutex> lock(state_mutex);
+            ++queued;
+            ++pending;
+        }
+        {
+            local_queue & q = *queues[id];
+            boost::lock_guard<boost::mutex> lock(q.mutex);
+            q.tasks.push_back(task);
+        }
+        work_available.notify_one();
+    }
+
+    /*
+     * Try our own deque first, then everyone else's. Blocks until a task is
+     * found, returning false if the pool has drained completely.
+     */
+    bool take(const size_t id, Task & task)
+    {
+        for (;;)
+        {
+            if (pop_own(id, task) || steal(id, task))
+            {
+                boost::lock_guard<boost::mutex> lock(state_mutex);
+                --queued;
+                return true;
+            }
+
+            boost::unique_lock<boost::mutex> lock(state_mutex);
+            while (queued == 0 && pending != 0)
+                work_available.wait(lock);
+            if (pending == 0)
+                return false;
+        }
+    }
+
+    bool pop_own(const size_t id, Task & task)
+    {
+        local_queue & q = *queues[id];
+        boost::lock_guard<boost::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(const size_t id, Task & task)
+    {
+        for (size_t k = 1;
+                k != queues.size();
+                ++k)
+        {
+            local_queue & q = *queues[(id + k) % queues.size()];
+            boost::lock_guard<boost::mutex> lock(q.mutex);
+            if (!q.tasks.empty())
+            {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void finish(void)
+    {
+        bool drained;
+        {
+            boost::lock_guard<boost::mutex> lock(state_mutex);
+            --pending;
+            ++completed;
+            drained = (pending == 0);
+        }
+        if (drained)
+            work_available.notify_all();
+    }
+
+    std::vector< boost::shared_ptr<local_queue> > queues;
+    size_t next_seed;
+
+    boost::mutex              state_mutex;
+    boost::condition_variable work_available;
+    size_t                    queued;
+    size_t                    pending;
+    size_t                    completed;
+};
+
+} // namespace tile_generator
+
+#endif // RSME_INCLUDED_WORK_STEALING_POOL_HPP